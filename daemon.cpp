@@ -0,0 +1,498 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "outbuf.h"
+#include "print_img.h"
+#include "render_cache.h"
+
+// Protocol: the client sends a daemon_request and its payload, the daemon
+// answers with a daemon_response and the escape stream (or an error
+// message), then closes the connection. Both ends run on the same host, so
+// the headers are sent as native structs.
+#define DAEMON_MAGIC     0x676d6970  // "pimg"
+#define DAEMON_VERSION   1
+#define DAEMON_MAX_INPUT (256 << 20)
+
+#define DAEMON_INPUT_BYTES 0  // payload is the encoded image
+#define DAEMON_INPUT_PATH  1  // payload is the path of an image file
+
+// Decoded images kept between requests.
+#define DAEMON_CACHE_SLOTS 16
+
+// A client that stops sending does not hold up the others for longer.
+#define DAEMON_IO_TIMEOUT_S 5
+
+struct daemon_request
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t input;   // DAEMON_INPUT_*
+    uint32_t length;  // payload bytes
+    int32_t  width;
+    int32_t  height;
+    int32_t  mode;
+    int32_t  resample;
+    int32_t  colors;
+    int32_t  glyphs;
+    int32_t  cell_scale;
+    int32_t  term_caps;
+    int32_t  background;
+    float    exposure;
+    int32_t  term_cols;  // the client's terminal
+    int32_t  term_rows;
+    int32_t  term_xpixel;
+    int32_t  term_ypixel;
+};
+
+struct daemon_response
+{
+    int32_t  status;  // 0, or -1 with a message as payload
+    uint32_t length;
+};
+
+struct cached_image
+{
+    uint64_t          key;
+    uint64_t          used;  // request counter at the last hit, 0 if empty
+    print_img_image_t image;
+};
+
+static volatile sig_atomic_t daemon_quit = 0;
+
+static void on_quit(int sig)
+{
+    (void)sig;
+    daemon_quit = 1;
+}
+
+void print_img_socket_path(char *path, size_t size)
+{
+    const char *env = getenv("PIMG_SOCKET");
+    const char *run = getenv("XDG_RUNTIME_DIR");
+    if (env != NULL && *env != '\0')
+    {
+        snprintf(path, size, "%s", env);
+    }
+    else if (run != NULL && *run != '\0')
+    {
+        snprintf(path, size, "%s/pimg.sock", run);
+    }
+    else
+    {
+        snprintf(path, size, "/tmp/pimg-%u.sock", (unsigned)getuid());
+    }
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = read(fd, (char *)buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+    outbuf_t ob;
+    ob.data = (char *)buf;
+    ob.len  = len;
+    ob.cap  = len;
+    return outbuf_flush_fd(&ob, fd);
+}
+
+static int unix_socket(const char *path, struct sockaddr_un *addr)
+{
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+}
+
+// Whether the process at the other end of a connected socket runs as this
+// user. The /tmp fallback path can be bound by anyone first.
+static bool peer_is_same_user(int fd)
+{
+    struct ucred cred;
+    socklen_t    len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+    {
+        return false;
+    }
+    return cred.uid == getuid();
+}
+
+// Read a whole file into buf, replacing its contents.
+static int read_file(const char *path, outbuf_t *buf)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size > DAEMON_MAX_INPUT)
+    {
+        close(fd);
+        return -1;
+    }
+
+    buf->len = 0;
+    outbuf_reserve(buf, (size_t)st.st_size);
+    int ret = read_full(fd, buf->data, (size_t)st.st_size);
+    close(fd);
+    buf->len = ret == 0 ? (size_t)st.st_size : 0;
+    return ret;
+}
+
+static void send_response(int fd, int status, const char *data, size_t len)
+{
+    struct daemon_response resp;
+    resp.status = status;
+    resp.length = (uint32_t)len;
+    if (write_full(fd, &resp, sizeof(resp)) == 0)
+    {
+        write_full(fd, data, len);
+    }
+}
+
+static void send_error(int fd, const char *msg)
+{
+    send_response(fd, -1, msg, strlen(msg));
+}
+
+// Find the decoded image for key, or decode it into the least recently used
+// slot.
+static const print_img_image_t *cache_lookup(struct cached_image    *cache,
+                                             uint64_t                key,
+                                             uint64_t                now,
+                                             unsigned char          *img,
+                                             size_t                  size,
+                                             const print_img_opts_t *opts)
+{
+    struct cached_image *slot = &cache[0];
+    for (int i = 0; i < DAEMON_CACHE_SLOTS; i++)
+    {
+        if (cache[i].used != 0 && cache[i].key == key)
+        {
+            cache[i].used = now;
+            return &cache[i].image;
+        }
+        if (cache[i].used < slot->used)
+        {
+            slot = &cache[i];
+        }
+    }
+
+    if (slot->used != 0)
+    {
+        print_img_image_free(&slot->image);
+        slot->used = 0;
+    }
+    if (print_img_decode(img, (int)size, opts, &slot->image) != 0)
+    {
+        return NULL;
+    }
+    slot->key  = key;
+    slot->used = now;
+    return &slot->image;
+}
+
+struct daemon_state
+{
+    struct cached_image cache[DAEMON_CACHE_SLOTS];
+    uint64_t            requests;
+    outbuf_t            input;  // request payload, reused
+    outbuf_t            file;   // image read from a path, reused
+    outbuf_t            out;    // rendered stream, reused
+};
+
+static void serve_client(struct daemon_state *st, int fd)
+{
+    struct daemon_request req;
+    if (read_full(fd, &req, sizeof(req)) != 0)
+    {
+        return;
+    }
+    if (req.magic != DAEMON_MAGIC || req.version != DAEMON_VERSION ||
+        req.length > DAEMON_MAX_INPUT)
+    {
+        send_error(fd, "bad request");
+        return;
+    }
+
+    st->input.len = 0;
+    outbuf_reserve(&st->input, req.length + 1);
+    if (read_full(fd, st->input.data, req.length) != 0)
+    {
+        return;
+    }
+    st->input.len = req.length;
+
+    outbuf_t *img = &st->input;
+    if (req.input == DAEMON_INPUT_PATH)
+    {
+        st->input.data[req.length] = '\0';
+        if (read_file(st->input.data, &st->file) != 0)
+        {
+            send_error(fd, "cannot read image file");
+            return;
+        }
+        img = &st->file;
+    }
+
+    print_img_opts_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.width        = req.width;
+    opts.height       = req.height;
+    opts.mode         = req.mode;
+    opts.resample     = req.resample;
+    opts.colors       = req.colors;
+    opts.glyphs       = req.glyphs;
+    opts.cell_scale   = req.cell_scale;
+    opts.term_caps    = req.term_caps;
+    opts.background   = req.background;
+    opts.exposure     = req.exposure;
+    opts.term_cols    = req.term_cols;
+    opts.term_rows    = req.term_rows;
+    opts.term_xpixel  = req.term_xpixel;
+    opts.term_ypixel  = req.term_ypixel;
+    opts.always_clear = 1;  // every client is a fresh screen
+
+    // What print_img_decode() depends on, besides the image.
+    struct
+    {
+        int32_t width;
+        int32_t height;
+        int32_t mode;
+        float   exposure;
+    } decode_key;
+    memset(&decode_key, 0, sizeof(decode_key));
+    decode_key.width    = req.width;
+    decode_key.height   = req.height;
+    decode_key.mode     = req.mode;
+    decode_key.exposure = req.exposure;
+
+    uint64_t key = content_hash(&decode_key, sizeof(decode_key),
+                                content_hash(img->data, img->len, 0));
+
+    const print_img_image_t *image =
+        cache_lookup(st->cache, key, ++st->requests,
+                     (unsigned char *)img->data, img->len, &opts);
+    if (image == NULL)
+    {
+        send_error(fd, "cannot decode image");
+        return;
+    }
+
+    st->out.len = 0;
+    if (print_img_render_buf(image, &opts, &st->out) != 0)
+    {
+        send_error(fd, "cannot render image");
+        return;
+    }
+    send_response(fd, 0, st->out.data, st->out.len);
+}
+
+int print_img_daemon(const char *path)
+{
+    struct sockaddr_un addr;
+    int                fd = unix_socket(path, &addr);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    // Take over a socket left behind by a daemon that died, but not one that
+    // is still answering.
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    {
+        fprintf(stderr, "A daemon is already listening on %s\n", path);
+        close(fd);
+        return -1;
+    }
+    unlink(path);
+
+    mode_t old_mask = umask(077);
+    int    ret      = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (ret != 0 || listen(fd, 16) != 0)
+    {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    // No SA_RESTART: a signal has to interrupt accept().
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_quit;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct daemon_state *st =
+        (struct daemon_state *)calloc(1, sizeof(struct daemon_state));
+    outbuf_init(&st->input);
+    outbuf_init(&st->file);
+    outbuf_init(&st->out);
+
+    struct timeval timeout = {DAEMON_IO_TIMEOUT_S, 0};
+    while (!daemon_quit)
+    {
+        int client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        serve_client(st, client);
+        close(client);
+    }
+
+    close(fd);
+    unlink(path);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    for (int i = 0; i < DAEMON_CACHE_SLOTS; i++)
+    {
+        if (st->cache[i].used != 0)
+        {
+            print_img_image_free(&st->cache[i].image);
+        }
+    }
+    outbuf_free(&st->input);
+    outbuf_free(&st->file);
+    outbuf_free(&st->out);
+    free(st);
+    return 0;
+}
+
+int print_img_client(const char             *path,
+                     const char             *img_path,
+                     const print_img_opts_t *opts)
+{
+    char full_path[PATH_MAX];
+    if (realpath(img_path, full_path) == NULL)
+    {
+        return -1;
+    }
+
+    struct daemon_request req;
+    memset(&req, 0, sizeof(req));
+    req.magic      = DAEMON_MAGIC;
+    req.version    = DAEMON_VERSION;
+    req.input      = DAEMON_INPUT_PATH;
+    req.length     = (uint32_t)strlen(full_path);
+    req.width      = (int32_t)opts->width;
+    req.height     = (int32_t)opts->height;
+    req.mode       = opts->mode;
+    req.resample   = opts->resample;
+    req.colors     = opts->colors;
+    req.glyphs     = opts->glyphs;
+    req.cell_scale = opts->cell_scale;
+    req.term_caps  = opts->term_caps;
+    req.background = opts->background;
+    req.exposure   = opts->exposure;
+
+    // Fit the terminal the client runs in; 80x24 like a local render when
+    // stdout is not one.
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col != 0 &&
+        ws.ws_row != 0)
+    {
+        req.term_cols   = ws.ws_col;
+        req.term_rows   = ws.ws_row;
+        req.term_xpixel = ws.ws_xpixel;
+        req.term_ypixel = ws.ws_ypixel;
+    }
+    else
+    {
+        req.term_cols = 80;
+        req.term_rows = 24;
+    }
+
+    struct sockaddr_un addr;
+    int                fd = unix_socket(path, &addr);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (!peer_is_same_user(fd))
+    {
+        fprintf(stderr, "Ignoring daemon at %s: owned by another user\n",
+                path);
+        close(fd);
+        return -1;
+    }
+    if (write_full(fd, &req, sizeof(req)) != 0 ||
+        write_full(fd, full_path, req.length) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    struct daemon_response resp;
+    if (read_full(fd, &resp, sizeof(resp)) != 0 || resp.status != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // Take the whole answer before writing any of it: a connection lost
+    // halfway would leave a cut escape sequence on the terminal, and the
+    // caller could no longer render locally.
+    outbuf_t answer;
+    outbuf_init(&answer);
+    outbuf_reserve(&answer, resp.length);
+    int ret = read_full(fd, answer.data, resp.length);
+    close(fd);
+    if (ret == 0 && resp.length > 0)
+    {
+        fwrite(answer.data, 1, resp.length, stdout);
+    }
+    outbuf_free(&answer);
+    return ret == 0 ? 0 : -1;
+}
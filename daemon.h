@@ -0,0 +1,33 @@
+#ifndef _DAEMON_H
+#define _DAEMON_H
+
+#include <stddef.h>
+
+#include "print_img.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Socket the daemon listens on: $PIMG_SOCKET, else pimg.sock in
+// $XDG_RUNTIME_DIR, else /tmp/pimg-<uid>.sock.
+void print_img_socket_path(char *path, size_t size);
+
+// Serve render requests on the Unix socket at path until SIGINT/SIGTERM.
+// Decoded images are kept in a small LRU, so repeated requests for the same
+// image only pay for resizing and encoding.
+int print_img_daemon(const char *path);
+
+// Render img_path through the daemon at path, for the terminal on stdout,
+// and write the result to stdout. Returns -1 without writing anything when
+// the daemon cannot be reached, runs as another user, fails or drops the
+// connection before the whole answer arrived, so the caller can render
+// locally.
+int print_img_client(const char             *path,
+                     const char             *img_path,
+                     const print_img_opts_t *opts);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
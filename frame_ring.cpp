@@ -0,0 +1,101 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "frame_ring.h"
+
+#define RING_SLOTS 3
+
+// The shared slot word: slot index in the low bits, RING_FRESH while it holds
+// a frame the consumer has not taken, and the publish count above them.
+#define RING_INDEX_MASK  3
+#define RING_FRESH       4
+#define RING_COUNT_SHIFT 3
+
+// back is only used by the producer and front only by the consumer; middle
+// is swapped between them with atomic exchanges, which also order the frame
+// data written before a publish against the reads after taking it.
+struct frame_ring
+{
+    unsigned char *frames;
+    size_t         frame_size;
+    uint64_t       published;  // producer: frames published so far
+    int            back;
+    uint64_t       middle;
+    int            front;
+    uint64_t       taken;  // consumer: publish count of the last frame taken
+    int            closed;
+};
+
+frame_ring_t *frame_ring_create(size_t frame_size)
+{
+    frame_ring_t *ring = (frame_ring_t *)calloc(1, sizeof(frame_ring_t));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+    ring->frames = (unsigned char *)malloc(frame_size * RING_SLOTS);
+    if (ring->frames == NULL)
+    {
+        free(ring);
+        return NULL;
+    }
+    ring->frame_size = frame_size;
+    ring->back       = 0;
+    ring->middle     = 1;
+    ring->front      = 2;
+    return ring;
+}
+
+void frame_ring_destroy(frame_ring_t *ring)
+{
+    if (ring != NULL)
+    {
+        free(ring->frames);
+        free(ring);
+    }
+}
+
+unsigned char *frame_ring_acquire(frame_ring_t *ring)
+{
+    return ring->frames + ring->frame_size * ring->back;
+}
+
+void frame_ring_publish(frame_ring_t *ring)
+{
+    ring->published++;
+    uint64_t word = ring->published << RING_COUNT_SHIFT | RING_FRESH |
+                    (uint64_t)ring->back;
+    uint64_t old = __atomic_exchange_n(&ring->middle, word, __ATOMIC_ACQ_REL);
+    ring->back   = (int)(old & RING_INDEX_MASK);
+}
+
+void frame_ring_close(frame_ring_t *ring)
+{
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+}
+
+unsigned char *frame_ring_latest(frame_ring_t *ring, unsigned long *skipped)
+{
+    *skipped = 0;
+
+    // Only the consumer clears RING_FRESH, so a fresh frame stays there (or
+    // is replaced by a newer one) until the exchange below.
+    if (!(__atomic_load_n(&ring->middle, __ATOMIC_ACQUIRE) & RING_FRESH))
+    {
+        return NULL;
+    }
+
+    // Give the slot just shown back in exchange for the newest frame.
+    uint64_t old = __atomic_exchange_n(&ring->middle, (uint64_t)ring->front,
+                                       __ATOMIC_ACQ_REL);
+    uint64_t count = old >> RING_COUNT_SHIFT;
+    *skipped       = (unsigned long)(count - ring->taken - 1);
+    ring->taken    = count;
+    ring->front    = (int)(old & RING_INDEX_MASK);
+    return ring->frames + ring->frame_size * ring->front;
+}
+
+bool frame_ring_closed(frame_ring_t *ring)
+{
+    return __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE) != 0;
+}
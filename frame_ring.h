@@ -0,0 +1,35 @@
+#ifndef _FRAME_RING_H
+#define _FRAME_RING_H
+
+#include <stddef.h>
+
+// Lock-free single-producer/single-consumer exchange of fixed size frames,
+// built as a triple buffer: the producer fills one slot, the consumer reads
+// another, and the third holds the newest finished frame. Publishing swaps
+// the filled slot with that third one, overwriting whatever the consumer has
+// not taken yet. Neither side ever waits, and the consumer always gets the
+// newest frame read, however long it spent on the previous one.
+typedef struct frame_ring frame_ring_t;
+
+frame_ring_t *frame_ring_create(size_t frame_size);
+void          frame_ring_destroy(frame_ring_t *ring);
+
+// Producer: the slot to fill next. Never NULL.
+unsigned char *frame_ring_acquire(frame_ring_t *ring);
+
+// Producer: hand the slot from frame_ring_acquire() to the consumer,
+// replacing an older frame it has not taken.
+void frame_ring_publish(frame_ring_t *ring);
+
+// Producer: no frames will follow.
+void frame_ring_close(frame_ring_t *ring);
+
+// Consumer: the newest published frame, or NULL when there is none since
+// the last call. It stays valid until the next call. skipped is set to the
+// number of frames published since the last one taken that were replaced
+// unseen.
+unsigned char *frame_ring_latest(frame_ring_t *ring, unsigned long *skipped);
+
+// Consumer: whether the producer has closed the ring.
+bool frame_ring_closed(frame_ring_t *ring);
+#endif
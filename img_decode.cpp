@@ -0,0 +1,1017 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb/stb_image.h"
+
+#include "img_decode.h"
+#include "worker_pool.h"
+
+// Baseline JPEG decoder built on stb_image's internals.
+//
+// Downscale-on-decode: a 1/2^shift reduced image is produced straight from
+// the DCT coefficients. Every 8x8 block is inverse transformed to a
+// (8>>shift)^2 block using only its low frequency coefficients (only the DC
+// term at 1/8), so neither the full IDCT nor the full resolution planes are
+// ever needed.
+//
+// Parallel decoding: scans with restart intervals are split at the RSTn
+// markers and the intervals are huffman decoded on the worker pool, and
+// upsampling/color conversion runs in bands of rows. At full scale the
+// output is identical to stbi_load_from_memory.
+
+#define IDCT_SCALE_BITS 10
+
+// IDCT_N[x * n + u] = c(u) * cos((2x + 1) * u * pi / 2n), c(0) = 1,
+// c(u) = sqrt(2); with the final /8 this is the JPEG 8x8 IDCT evaluated on
+// an n point grid.
+static int IDCT_4[4 * 4];
+static int IDCT_2[2 * 2];
+
+static void build_idct_tables(void)
+{
+    for (int x = 0; x < 4; x++)
+    {
+        for (int u = 0; u < 4; u++)
+        {
+            double c = (u == 0 ? 1.0 : 1.41421356) *
+                       cos((2 * x + 1) * u * 3.14159265 / 8.0);
+            IDCT_4[x * 4 + u] = (int)lround(c * (1 << IDCT_SCALE_BITS));
+        }
+    }
+    for (int x = 0; x < 2; x++)
+    {
+        for (int u = 0; u < 2; u++)
+        {
+            double c = (u == 0 ? 1.0 : 1.41421356) *
+                       cos((2 * x + 1) * u * 3.14159265 / 4.0);
+            IDCT_2[x * 2 + u] = (int)lround(c * (1 << IDCT_SCALE_BITS));
+        }
+    }
+}
+
+// Decodes may start on several threads at once when the library is embedded.
+static void init_idct_tables(void)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, build_idct_tables);
+}
+
+static inline stbi_uc clamp_sample(int v)
+{
+    return (stbi_uc)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+// data[] holds dequantized coefficients in natural (row major) order.
+static void idct_scaled(stbi_uc *out, int out_stride, short data[64], int shift)
+{
+    if (shift == 3)
+    {
+        *out = clamp_sample(((data[0] + 4) >> 3) + 128);
+        return;
+    }
+
+    int        n = 8 >> shift;
+    const int *t = (shift == 1) ? IDCT_4 : IDCT_2;
+    int        tmp[4 * 4];
+
+    const int round = 1 << (IDCT_SCALE_BITS - 1);
+    for (int v = 0; v < n; v++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            int sum = 0;
+            for (int u = 0; u < n; u++)
+            {
+                sum += data[v * 8 + u] * t[x * n + u];
+            }
+            tmp[v * n + x] = (sum + round) >> IDCT_SCALE_BITS;
+        }
+    }
+
+    for (int y = 0; y < n; y++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            int sum = 0;
+            for (int v = 0; v < n; v++)
+            {
+                sum += tmp[v * n + x] * t[y * n + v];
+            }
+            sum = (sum + round) >> IDCT_SCALE_BITS;
+            out[y * out_stride + x] = clamp_sample(((sum + 4) >> 3) + 128);
+        }
+    }
+}
+
+static void jpeg_store_block(stbi__jpeg *z,
+                             int         n,
+                             int         bx,
+                             int         by,
+                             short       data[64],
+                             int         shift)
+{
+    int      bs  = 8 >> shift;
+    stbi_uc *out = z->img_comp[n].data + z->img_comp[n].w2 * by * bs + bx * bs;
+    if (shift == 0)
+    {
+        z->idct_block_kernel(out, z->img_comp[n].w2, data);
+    }
+    else
+    {
+        idct_scaled(out, z->img_comp[n].w2, data, shift);
+    }
+}
+
+static int jpeg_decode_store(stbi__jpeg *z, int n, int bx, int by, int shift)
+{
+    STBI_SIMD_ALIGN(short, data[64]);
+    int ha = z->img_comp[n].ha;
+    if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd,
+                                 z->huff_ac + ha, z->fast_ac[ha], n,
+                                 z->dequant[z->img_comp[n].tq]))
+    {
+        return 0;
+    }
+    jpeg_store_block(z, n, bx, by, data, shift);
+    return 1;
+}
+
+// Number of MCUs in the current sequential scan. A non-interleaved scan has
+// one block per MCU, laid out in the component's own block grid.
+static int jpeg_scan_mcus(stbi__jpeg *z)
+{
+    if (z->scan_n == 1)
+    {
+        int n = z->order[0];
+        return ((z->img_comp[n].x + 7) >> 3) * ((z->img_comp[n].y + 7) >> 3);
+    }
+    return z->img_mcu_x * z->img_mcu_y;
+}
+
+// Decode MCU number m of the current sequential scan, the same way
+// stbi__parse_entropy_coded_data() walks them.
+static int jpeg_decode_mcu(stbi__jpeg *z, int m, int shift)
+{
+    if (z->scan_n == 1)
+    {
+        int n = z->order[0];
+        int w = (z->img_comp[n].x + 7) >> 3;
+        return jpeg_decode_store(z, n, m % w, m / w, shift);
+    }
+
+    int i = m % z->img_mcu_x;
+    int j = m / z->img_mcu_x;
+    for (int k = 0; k < z->scan_n; ++k)
+    {
+        int n = z->order[k];
+        for (int y = 0; y < z->img_comp[n].v; ++y)
+        {
+            for (int x = 0; x < z->img_comp[n].h; ++x)
+            {
+                if (!jpeg_decode_store(z, n, i * z->img_comp[n].h + x,
+                                       j * z->img_comp[n].v + y, shift))
+                {
+                    return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+static int jpeg_entropy_data(stbi__jpeg *z, int shift)
+{
+    int mcus = jpeg_scan_mcus(z);
+
+    stbi__jpeg_reset(z);
+    for (int m = 0; m < mcus; m++)
+    {
+        if (!jpeg_decode_mcu(z, m, shift))
+        {
+            return 0;
+        }
+        if (--z->todo <= 0)
+        {
+            if (z->code_bits < 24)
+                stbi__grow_buffer_unsafe(z);
+            if (!STBI__RESTART(z->marker))
+                return 1;
+            stbi__jpeg_reset(z);
+        }
+    }
+    return 1;
+}
+
+struct jpeg_scan_job
+{
+    const stbi__jpeg *z;
+    int               shift;
+    int               mcus;
+    int               segments;
+    const stbi_uc   **seg_start;  // segments + 1 entries, the last one is the
+                                  // end of the scan
+    int               tasks;
+    int               failed;
+};
+
+static void jpeg_scan_task(void *arg, int task)
+{
+    struct jpeg_scan_job *job = (struct jpeg_scan_job *)arg;
+
+    // Every task gets its own decoder state and bit reader; the huffman and
+    // quantization tables are shared read-only copies.
+    stbi__jpeg *z = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+    if (z == NULL)
+    {
+        job->failed = 1;
+        return;
+    }
+    memcpy(z, job->z, sizeof(stbi__jpeg));
+
+    stbi__context s;
+    z->s = &s;
+
+    int ri        = job->z->restart_interval;
+    int seg_begin = job->segments * task / job->tasks;
+    int seg_end   = job->segments * (task + 1) / job->tasks;
+    for (int seg = seg_begin; seg < seg_end && !job->failed; seg++)
+    {
+        stbi__start_mem(&s, job->seg_start[seg],
+                        (int)(job->seg_start[seg + 1] - job->seg_start[seg]));
+        stbi__jpeg_reset(z);
+
+        int m_end = (seg + 1) * ri < job->mcus ? (seg + 1) * ri : job->mcus;
+        for (int m = seg * ri; m < m_end; m++)
+        {
+            if (!jpeg_decode_mcu(z, m, job->shift))
+            {
+                job->failed = 1;
+                break;
+            }
+        }
+    }
+
+    STBI_FREE(z);
+}
+
+// Decode a sequential scan with restart intervals on the worker pool.
+// Returns -1 when the scan does not qualify, leaving the stream untouched.
+static int jpeg_entropy_data_parallel(stbi__jpeg *z, int shift)
+{
+    int ri = z->restart_interval;
+    if (ri <= 0 || pool_threads() == 1)
+    {
+        return -1;
+    }
+
+    int mcus     = jpeg_scan_mcus(z);
+    int segments = (mcus + ri - 1) / ri;
+    if (segments < 2)
+    {
+        return -1;
+    }
+
+    const stbi_uc **seg_start =
+        (const stbi_uc **)malloc((segments + 1) * sizeof(stbi_uc *));
+    const stbi_uc *p     = z->s->img_buffer;
+    const stbi_uc *end   = z->s->img_buffer_end;
+    int            found = 1;
+
+    seg_start[0] = p;
+    while (p + 1 < end)
+    {
+        if (p[0] != 0xff || p[1] == 0xff)
+        {
+            p++;
+        }
+        else if (p[1] == 0x00)
+        {
+            p += 2;  // stuffed zero byte
+        }
+        else if (STBI__RESTART(p[1]))
+        {
+            p += 2;
+            if (found < segments)
+            {
+                seg_start[found] = p;
+            }
+            found++;
+        }
+        else
+        {
+            break;  // the marker after the scan
+        }
+    }
+    seg_start[segments] = p;
+
+    if (found != segments)
+    {
+        free(seg_start);
+        return -1;
+    }
+
+    struct jpeg_scan_job job;
+    job.z         = z;
+    job.shift     = shift;
+    job.mcus      = mcus;
+    job.segments  = segments;
+    job.seg_start = seg_start;
+    job.tasks =
+        segments < pool_threads() * 4 ? segments : pool_threads() * 4;
+    job.failed    = 0;
+    pool_run(job.tasks, jpeg_scan_task, &job);
+
+    free(seg_start);
+
+    // Continue parsing at the marker that ends the scan.
+    z->s->img_buffer = (stbi_uc *)p;
+    z->marker        = STBI__MARKER_none;
+    return !job.failed;
+}
+
+// Mirrors the MCU bookkeeping of stbi__process_frame_header(), but allocates
+// the component planes at the (possibly reduced) output size.
+static int jpeg_scaled_alloc(stbi__jpeg *z, int shift)
+{
+    stbi__context *s     = z->s;
+    int            h_max = 1, v_max = 1;
+
+    for (int i = 0; i < s->img_n; ++i)
+    {
+        if (z->img_comp[i].h > h_max)
+            h_max = z->img_comp[i].h;
+        if (z->img_comp[i].v > v_max)
+            v_max = z->img_comp[i].v;
+    }
+    for (int i = 0; i < s->img_n; ++i)
+    {
+        if (h_max % z->img_comp[i].h != 0 || v_max % z->img_comp[i].v != 0)
+        {
+            return 0;
+        }
+    }
+
+    z->img_h_max = h_max;
+    z->img_v_max = v_max;
+    z->img_mcu_w = h_max * 8;
+    z->img_mcu_h = v_max * 8;
+    z->img_mcu_x = (s->img_x + z->img_mcu_w - 1) / z->img_mcu_w;
+    z->img_mcu_y = (s->img_y + z->img_mcu_h - 1) / z->img_mcu_h;
+
+    for (int i = 0; i < s->img_n; ++i)
+    {
+        z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max - 1) / h_max;
+        z->img_comp[i].y = (s->img_y * z->img_comp[i].v + v_max - 1) / v_max;
+        z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> shift);
+        z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> shift);
+        z->img_comp[i].raw_data =
+            stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
+        if (z->img_comp[i].raw_data == NULL)
+        {
+            return 0;
+        }
+        // Blocks a truncated scan never reaches stay mid-gray, as in
+        // stbi__process_frame_header().
+        memset(z->img_comp[i].raw_data, 128,
+               (size_t)z->img_comp[i].w2 * z->img_comp[i].h2 + 15);
+        z->img_comp[i].data =
+            (stbi_uc *)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
+    }
+    return 1;
+}
+
+struct jpeg_color_job
+{
+    stbi__jpeg *z;
+    stbi_uc    *output;
+    int         out_w;
+    int         out_h;
+    int         channels;  // 3 for RGB, 1 for luma only
+    bool        is_rgb;
+    int        *near_row[4];  // per output row: plane rows to upsample from
+    int        *far_row[4];
+    int         bands;
+    int         failed;
+};
+
+static resample_row_func jpeg_resampler(stbi__jpeg *z, int hs, int vs)
+{
+    if (hs == 1 && vs == 1)
+        return resample_row_1;
+    if (hs == 1 && vs == 2)
+        return stbi__resample_row_v_2;
+    if (hs == 2 && vs == 1)
+        return stbi__resample_row_h_2;
+    if (hs == 2 && vs == 2)
+        return z->resample_row_hv_2_kernel;
+    return stbi__resample_row_generic;
+}
+
+// Upsample and color convert one band of output rows with stb_image's own
+// kernels.
+static void jpeg_color_band(void *arg, int band)
+{
+    struct jpeg_color_job *job   = (struct jpeg_color_job *)arg;
+    stbi__jpeg            *z     = job->z;
+    int                    img_n = z->s->img_n;
+    int                    out_w = job->out_w;
+
+    int row_begin = job->out_h * band / job->bands;
+    int row_end   = job->out_h * (band + 1) / job->bands;
+
+    // Line buffers big enough for upsampling off the edges.
+    stbi_uc *lines = (stbi_uc *)stbi__malloc_mad2(out_w + 3, img_n, 0);
+    if (lines == NULL)
+    {
+        job->failed = 1;
+        return;
+    }
+
+    // The Y plane of a YCbCr image already is the luma; skip the chroma.
+    int planes = img_n;
+    if (job->channels == 1 && !job->is_rgb)
+    {
+        planes = 1;
+    }
+
+    for (int j = row_begin; j < row_end; ++j)
+    {
+        stbi_uc *out = job->output + (size_t)job->channels * out_w * j;
+        stbi_uc *row[3];
+        for (int k = 0; k < planes; ++k)
+        {
+            int hs = z->img_h_max / z->img_comp[k].h;
+            int vs = z->img_v_max / z->img_comp[k].v;
+
+            stbi_uc *plane = z->img_comp[k].data;
+            int      w2    = z->img_comp[k].w2;
+            row[k]         = jpeg_resampler(z, hs, vs)(
+                lines + (out_w + 3) * k, plane + w2 * job->near_row[k][j],
+                plane + w2 * job->far_row[k][j], (out_w + hs - 1) / hs, hs);
+        }
+
+        if (job->channels == 1 && planes == 1)
+        {
+            memcpy(out, row[0], out_w);
+        }
+        else if (job->channels == 1)
+        {
+            for (int i = 0; i < out_w; ++i)
+            {
+                out[i] = stbi__compute_y(row[0][i], row[1][i], row[2][i]);
+            }
+        }
+        else if (img_n == 1)
+        {
+            for (int i = 0; i < out_w; ++i, out += 3)
+            {
+                out[0] = out[1] = out[2] = row[0][i];
+            }
+        }
+        else if (job->is_rgb)
+        {
+            for (int i = 0; i < out_w; ++i, out += 3)
+            {
+                out[0] = row[0][i];
+                out[1] = row[1][i];
+                out[2] = row[2][i];
+            }
+        }
+        else
+        {
+            // The row kernels store a fourth byte per pixel, which must not
+            // land in the next band's first row: convert all but the last
+            // pixel in place and finish that one by hand.
+            if (out_w > 1)
+            {
+                z->YCbCr_to_RGB_kernel(out, row[0], row[1], row[2], out_w - 1,
+                                       3);
+            }
+            stbi_uc last[4];
+            int     i = out_w - 1;
+            stbi__YCbCr_to_RGB_row(last, row[0] + i, row[1] + i, row[2] + i, 1,
+                                   4);
+            memcpy(out + 3 * i, last, 3);
+        }
+    }
+
+    STBI_FREE(lines);
+}
+
+static stbi_uc *jpeg_to_rgb(stbi__jpeg *z,
+                            int         out_w,
+                            int         out_h,
+                            int         channels,
+                            int         shift)
+{
+    int      img_n  = z->s->img_n;
+    stbi_uc *output = (stbi_uc *)stbi__malloc_mad3(channels, out_w, out_h, 0);
+    int     *rows =
+        (int *)stbi__malloc_mad3(2 * img_n, out_h, sizeof(int), 0);
+    if (output == NULL || rows == NULL)
+    {
+        STBI_FREE(output);
+        STBI_FREE(rows);
+        return NULL;
+    }
+
+    struct jpeg_color_job job;
+    job.z        = z;
+    job.output   = output;
+    job.out_w    = out_w;
+    job.out_h    = out_h;
+    job.channels = channels;
+    job.is_rgb   = img_n == 3 && (z->rgb == 3 ||
+                                  (z->app14_color_transform == 0 && !z->jfif));
+    job.bands    = out_h < pool_threads() ? out_h : pool_threads();
+    job.failed   = 0;
+
+    // Replay the vertical stepping of load_jpeg_image() once, so that every
+    // band knows its source rows up front.
+    for (int k = 0; k < img_n; ++k)
+    {
+        int vs     = z->img_v_max / z->img_comp[k].v;
+        int comp_y = (z->img_comp[k].y + (1 << shift) - 1) >> shift;
+        int ystep  = vs >> 1;
+        int ypos   = 0;
+        int line0 = 0, line1 = 0;
+
+        job.near_row[k] = rows + out_h * (2 * k);
+        job.far_row[k]  = rows + out_h * (2 * k + 1);
+        for (int j = 0; j < out_h; ++j)
+        {
+            bool y_bot         = ystep >= (vs >> 1);
+            job.near_row[k][j] = y_bot ? line1 : line0;
+            job.far_row[k][j]  = y_bot ? line0 : line1;
+            if (++ystep >= vs)
+            {
+                ystep = 0;
+                line0 = line1;
+                if (++ypos < comp_y)
+                    line1++;
+            }
+        }
+    }
+
+    pool_run(job.bands, jpeg_color_band, &job);
+
+    STBI_FREE(rows);
+    if (job.failed)
+    {
+        STBI_FREE(output);
+        return NULL;
+    }
+    return output;
+}
+
+static stbi_uc *load_jpeg_fast(const unsigned char *buf,
+                               int                  len,
+                               int                 *width,
+                               int                 *height,
+                               int                  channels,
+                               int                  shift)
+{
+    stbi__context s;
+    stbi__start_mem(&s, buf, len);
+
+    stbi__jpeg *z = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+    if (z == NULL)
+    {
+        return NULL;
+    }
+    z->s = &s;
+    stbi__setup_jpeg(z);
+    for (int m = 0; m < 4; m++)
+    {
+        z->img_comp[m].raw_data  = NULL;
+        z->img_comp[m].raw_coeff = NULL;
+        z->img_comp[m].linebuf   = NULL;
+    }
+    z->restart_interval = 0;
+    s.img_n             = 0;
+
+    stbi_uc *result = NULL;
+    int      m;
+
+    // CMYK/YCCK and progressive files take the regular path.
+    if (!stbi__decode_jpeg_header(z, STBI__SCAN_header) || z->progressive ||
+        s.img_n == 4 || !jpeg_scaled_alloc(z, shift))
+    {
+        goto done;
+    }
+
+    m = stbi__get_marker(z);
+    while (!stbi__EOI(m))
+    {
+        if (stbi__SOS(m))
+        {
+            if (!stbi__process_scan_header(z))
+            {
+                goto done;
+            }
+            int r = jpeg_entropy_data_parallel(z, shift);
+            if (r < 0)
+            {
+                r = jpeg_entropy_data(z, shift);
+            }
+            if (!r)
+            {
+                goto done;
+            }
+            if (z->marker == STBI__MARKER_none)
+            {
+                while (!stbi__at_eof(z->s))
+                {
+                    int x = stbi__get8(z->s);
+                    if (x == 255)
+                    {
+                        z->marker = stbi__get8(z->s);
+                        break;
+                    }
+                }
+            }
+        }
+        else if (stbi__DNL(m))
+        {
+            goto done;
+        }
+        else if (!stbi__process_marker(z, m))
+        {
+            goto done;
+        }
+        m = stbi__get_marker(z);
+    }
+
+    *width  = (s.img_x + (1 << shift) - 1) >> shift;
+    *height = (s.img_y + (1 << shift) - 1) >> shift;
+    result  = jpeg_to_rgb(z, *width, *height, channels, shift);
+
+done:
+    stbi__free_jpeg_components(z, s.img_n, 0);
+    STBI_FREE(z);
+    return result;
+}
+
+// How many times an image can be halved, up to max_shift, and still cover
+// min_width x min_height.
+static int reduce_shift(int src_w,
+                        int src_h,
+                        int min_width,
+                        int min_height,
+                        int max_shift)
+{
+    int shift = 0;
+    if (min_width > 0 && min_height > 0)
+    {
+        while (shift < max_shift && (src_w >> (shift + 1)) >= min_width &&
+               (src_h >> (shift + 1)) >= min_height)
+        {
+            shift++;
+        }
+    }
+    return shift;
+}
+
+// How far a JPEG can be reduced while decoding and still cover
+// min_width x min_height, or -1 if buf is not a JPEG.
+static int jpeg_decode_shift(const unsigned char *buf,
+                             int                  len,
+                             int                  min_width,
+                             int                  min_height)
+{
+    stbi__context s;
+    stbi__start_mem(&s, buf, len);
+    if (!stbi__jpeg_test(&s))
+    {
+        return -1;
+    }
+
+    int src_w, src_h, comp;
+    if (!stbi_info_from_memory(buf, len, &src_w, &src_h, &comp))
+    {
+        return 0;
+    }
+    return reduce_shift(src_w, src_h, min_width, min_height, 3);
+}
+
+// High bit depth input: Radiance HDR (linear float) and 16-bit PNG/PNM.
+// The wide samples are box averaged over 2^shift blocks and brought down to
+// 8 bits in the same pass, tone mapped in the HDR case, so the full size
+// image is read once and never exists in 8 bits.
+
+#define WIDE_MAX_SHIFT 4
+#define TONE_LUT_SIZE  4096
+
+// Display value of a linear 0..1 sample, gamma 2.2 like stb_image's own
+// HDR to LDR conversion.
+static unsigned char TONE_LUT[TONE_LUT_SIZE + 1];
+
+static void build_tone_lut(void)
+{
+    for (int i = 0; i <= TONE_LUT_SIZE; i++)
+    {
+        double v    = pow((double)i / TONE_LUT_SIZE, 1 / 2.2);
+        TONE_LUT[i] = (unsigned char)lround(v * 255);
+    }
+}
+
+static void init_tone_lut(void)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, build_tone_lut);
+}
+
+struct wide_job
+{
+    const float    *hdr;   // linear samples, or NULL
+    const uint16_t *wide;  // 16-bit samples when hdr is NULL
+    int             src_w;
+    int             src_h;
+    int             channels;
+    int             shift;
+    float           exposure;  // linear scale applied to HDR samples
+    unsigned char  *dst;
+    int             dst_w;
+    int             dst_h;
+    int             bands;
+};
+
+static inline unsigned char tone_map(float v)
+{
+    v = v < 0 ? 0 : (v > 1 ? 1 : v);
+    return TONE_LUT[(int)(v * TONE_LUT_SIZE + 0.5f)];
+}
+
+// Alpha-weighted sums of one source row: the color channels add c * alpha
+// and the alpha channel adds alpha, with alpha in 0..1. Colors under
+// transparent pixels then do not bleed into the average.
+static void wide_add_row_alpha(const struct wide_job *job, int y, float *acc)
+{
+    int    ch    = job->channels;
+    int    color = ch - 1;
+    size_t row   = (size_t)job->src_w * ch * y;
+    if (job->hdr != NULL)
+    {
+        const float *src = job->hdr + row;
+        for (int x = 0; x < job->src_w; x++, src += ch)
+        {
+            float *a = acc + (x >> job->shift) * ch;
+            float  w = src[color];
+            for (int c = 0; c < color; c++)
+            {
+                a[c] += src[c] * w;
+            }
+            a[color] += w;
+        }
+        return;
+    }
+
+    const uint16_t *src = job->wide + row;
+    for (int x = 0; x < job->src_w; x++, src += ch)
+    {
+        float *a = acc + (x >> job->shift) * ch;
+        float  w = src[color] * (1.0f / 65535);
+        for (int c = 0; c < color; c++)
+        {
+            a[c] += src[c] * w;
+        }
+        a[color] += w;
+    }
+}
+
+static void wide_reduce_band(void *arg, int band)
+{
+    struct wide_job *job = (struct wide_job *)arg;
+    int              ch  = job->channels;
+    int   color = ch % 2 == 0 ? ch - 1 : ch;  // alpha is not tone mapped
+    int   row_begin = job->dst_h * band / job->bands;
+    int   row_end   = job->dst_h * (band + 1) / job->bands;
+    int   shift     = job->shift;
+    float *acc = (float *)malloc((size_t)job->dst_w * ch * sizeof(float));
+
+    for (int dy = row_begin; dy < row_end; dy++)
+    {
+        int y0 = dy << shift;
+        int y1 = y0 + (1 << shift);
+        if (y1 > job->src_h)
+        {
+            y1 = job->src_h;
+        }
+
+        // Sums of at most 16x16 16-bit samples are exact in a float.
+        memset(acc, 0, (size_t)job->dst_w * ch * sizeof(float));
+        for (int y = y0; y < y1; y++)
+        {
+            size_t row = (size_t)job->src_w * ch * y;
+            if (color != ch)
+            {
+                wide_add_row_alpha(job, y, acc);
+            }
+            else if (job->hdr != NULL)
+            {
+                const float *src = job->hdr + row;
+                for (int x = 0; x < job->src_w; x++)
+                {
+                    float *a = acc + (x >> shift) * ch;
+                    for (int c = 0; c < ch; c++)
+                    {
+                        a[c] += src[x * ch + c];
+                    }
+                }
+            }
+            else
+            {
+                const uint16_t *src = job->wide + row;
+                for (int x = 0; x < job->src_w; x++)
+                {
+                    float *a = acc + (x >> shift) * ch;
+                    for (int c = 0; c < ch; c++)
+                    {
+                        a[c] += src[x * ch + c];
+                    }
+                }
+            }
+        }
+
+        unsigned char *out = job->dst + (size_t)job->dst_w * ch * dy;
+        for (int dx = 0; dx < job->dst_w; dx++, out += ch)
+        {
+            int x0 = dx << shift;
+            int x1 = x0 + (1 << shift);
+            if (x1 > job->src_w)
+            {
+                x1 = job->src_w;
+            }
+            float  scale = 1.0f / ((x1 - x0) * (y1 - y0));
+            float *a     = acc + dx * ch;
+
+            // With alpha the color sums are weighted by it: divide them by
+            // the alpha sum instead of the pixel count.
+            float color_scale = scale;
+            if (color != ch)
+            {
+                color_scale = a[color] > 0 ? 1.0f / a[color] : 0;
+            }
+
+            if (job->hdr == NULL)
+            {
+                for (int c = 0; c < color; c++)
+                {
+                    out[c] = (unsigned char)(a[c] * color_scale *
+                                                 (255.0f / 65535) +
+                                             0.5f);
+                }
+                if (color != ch)
+                {
+                    out[color] = (unsigned char)(a[color] * scale * 255 + 0.5f);
+                }
+                continue;
+            }
+
+            // Reinhard on luminance keeps the hue of bright areas.
+            float px[3];
+            for (int c = 0; c < color; c++)
+            {
+                px[c] = a[c] * color_scale * job->exposure;
+            }
+            float lum = color == 1 ? px[0]
+                                   : 0.2126f * px[0] + 0.7152f * px[1] +
+                                         0.0722f * px[2];
+            float k   = 1.0f / (1.0f + (lum > 0 ? lum : 0));
+            for (int c = 0; c < color; c++)
+            {
+                out[c] = tone_map(px[c] * k);
+            }
+            if (color != ch)
+            {
+                float alpha = a[color] * scale;
+                out[color]  = (unsigned char)(alpha < 0   ? 0
+                                              : alpha > 1 ? 255
+                                                          : alpha * 255 + 0.5f);
+            }
+        }
+    }
+
+    free(acc);
+}
+
+// Decode an HDR or 16-bit image, or return NULL for anything else.
+static stbi_uc *load_wide(const unsigned char *buf,
+                          int                  len,
+                          int                 *width,
+                          int                 *height,
+                          int                  channels,
+                          int                  min_width,
+                          int                  min_height,
+                          float                exposure)
+{
+    struct wide_job job;
+    memset(&job, 0, sizeof(job));
+
+    int file_channels;
+    if (stbi_is_hdr_from_memory(buf, len))
+    {
+        job.hdr = stbi_loadf_from_memory(buf, len, &job.src_w, &job.src_h,
+                                         &file_channels, channels);
+        if (job.hdr == NULL)
+        {
+            return NULL;
+        }
+    }
+    else if (stbi_is_16_bit_from_memory(buf, len))
+    {
+        job.wide = stbi_load_16_from_memory(buf, len, &job.src_w, &job.src_h,
+                                            &file_channels, channels);
+        if (job.wide == NULL)
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        return NULL;
+    }
+
+    init_tone_lut();
+    job.channels = channels;
+    job.shift    = reduce_shift(job.src_w, job.src_h, min_width, min_height,
+                                WIDE_MAX_SHIFT);
+    job.exposure = exp2f(exposure);
+    job.dst_w    = (job.src_w + (1 << job.shift) - 1) >> job.shift;
+    job.dst_h    = (job.src_h + (1 << job.shift) - 1) >> job.shift;
+    job.dst = (stbi_uc *)stbi__malloc_mad3(channels, job.dst_w, job.dst_h, 0);
+    job.bands = job.dst_h < pool_threads() ? job.dst_h : pool_threads();
+
+    if (job.dst != NULL)
+    {
+        pool_run(job.bands, wide_reduce_band, &job);
+        *width  = job.dst_w;
+        *height = job.dst_h;
+    }
+
+    STBI_FREE((void *)job.hdr);
+    STBI_FREE((void *)job.wide);
+    return job.dst;
+}
+
+unsigned char *decode_image(const unsigned char *buf,
+                            int                  len,
+                            int                 *width,
+                            int                 *height,
+                            int                  channels,
+                            int                  min_width,
+                            int                  min_height,
+                            float                exposure)
+{
+    int shift = jpeg_decode_shift(buf, len, min_width, min_height);
+    if (shift >= 0)
+    {
+        init_idct_tables();
+        stbi_uc *data =
+            load_jpeg_fast(buf, len, width, height, channels, shift);
+        if (data != NULL)
+        {
+            return data;
+        }
+    }
+
+    stbi_uc *data = load_wide(buf, len, width, height, channels, min_width,
+                              min_height, exposure);
+    if (data != NULL)
+    {
+        return data;
+    }
+
+    // stb_image takes a PNM header cut short for a 0x0 image.
+    int file_channels;
+    data = stbi_load_from_memory(buf, len, width, height, &file_channels,
+                                 channels);
+    if (data != NULL && (*width < 1 || *height < 1))
+    {
+        stbi_image_free(data);
+        data = NULL;
+    }
+    return data;
+}
+
+unsigned char *decode_image_coarse(const unsigned char *buf,
+                                   int                  len,
+                                   int                 *width,
+                                   int                 *height,
+                                   int                  channels,
+                                   int                  min_width,
+                                   int                  min_height)
+{
+    int shift = jpeg_decode_shift(buf, len, min_width, min_height);
+    if (shift < 0 || shift == 3)
+    {
+        return NULL;
+    }
+
+    init_idct_tables();
+    return load_jpeg_fast(buf, len, width, height, channels, 3);
+}
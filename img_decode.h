@@ -0,0 +1,28 @@
+#ifndef _IMG_DECODE_H
+#define _IMG_DECODE_H
+
+// Decode an image to packed RGB (channels 3) or luma (channels 1). When
+// min_width/min_height are given, JPEGs are reduced by 1/2, 1/4 or 1/8 and
+// HDR or 16-bit images by up to 1/16 while decoding, as long as the result
+// stays at least that large. HDR images are scaled by exposure stops and
+// tone mapped. Free the result with stbi_image_free().
+unsigned char *decode_image(const unsigned char *buf,
+                            int                  len,
+                            int                 *width,
+                            int                 *height,
+                            int                  channels,
+                            int                  min_width,
+                            int                  min_height,
+                            float                exposure);
+
+// Quick 1/8 scale preview of a JPEG that decode_image() would decode at a
+// finer scale. NULL when there is nothing to refine or the format has no
+// cheap preview.
+unsigned char *decode_image_coarse(const unsigned char *buf,
+                                   int                  len,
+                                   int                 *width,
+                                   int                 *height,
+                                   int                  channels,
+                                   int                  min_width,
+                                   int                  min_height);
+#endif
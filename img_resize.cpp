@@ -0,0 +1,487 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb/stb_image_resize.h"
+
+#include "img_resize.h"
+#include "print_img.h"
+#include "worker_pool.h"
+
+// Shrinking by at least this much in both directions makes every output pixel
+// cover a whole block of source pixels, so a plain box average is as good as
+// stbir's filter kernels and a lot cheaper.
+#define AREA_RESAMPLE_MIN_RATIO 4
+
+// The output is cut into horizontal bands that run on the worker pool.
+struct resize_job
+{
+    const unsigned char *src;
+    int                  src_w;
+    int                  src_h;
+    unsigned char       *dst;
+    int                  dst_w;
+    int                  dst_h;
+    int                  channels;      // of src
+    int                  dst_channels;  // channels - 1 when src has alpha
+    int                  background;    // 0xRRGGBB under transparent pixels
+    int                  bands;
+    const int           *x_start;  // area: dst_w + 1 source column boundaries
+    int                  failed;
+};
+
+static void background_channels(int background, int channels, int *bg)
+{
+    bg[0] = (background >> 16) & 255;
+    bg[1] = (background >> 8) & 255;
+    bg[2] = background & 255;
+    if (channels == 1)
+    {
+        bg[0] = (bg[0] * 77 + bg[1] * 150 + bg[2] * 29) >> 8;
+    }
+}
+
+void composite_alpha(const unsigned char *src,
+                     unsigned char       *dst,
+                     size_t               pixels,
+                     int                  channels,
+                     int                  background)
+{
+    int color = channels - 1;
+    int bg[3];
+    background_channels(background, color, bg);
+
+    for (size_t i = 0; i < pixels; i++, src += channels, dst += color)
+    {
+        int a = src[color];
+        for (int c = 0; c < color; c++)
+        {
+            dst[c] = (unsigned char)((src[c] * a + bg[c] * (255 - a) + 127) /
+                                     255);
+        }
+    }
+}
+
+static void band_rows(const struct resize_job *job,
+                      int                      band,
+                      int                     *row_begin,
+                      int                     *row_end)
+{
+    *row_begin = job->dst_h * band / job->bands;
+    *row_end   = job->dst_h * (band + 1) / job->bands;
+}
+
+// Integer area average of one band of output rows. Source rows are first
+// summed column-wise into an accumulator row, then each output pixel adds up
+// its span of accumulated columns.
+static void area_resize_band(void *arg, int band)
+{
+    struct resize_job *job = (struct resize_job *)arg;
+    int                row_begin, row_end;
+    band_rows(job, band, &row_begin, &row_end);
+
+    int        ch     = job->channels;
+    size_t     stride = (size_t)job->src_w * ch;
+    uint32_t  *colsum = (uint32_t *)malloc(stride * sizeof(uint32_t));
+    const int *xs     = job->x_start;
+
+    for (int dy = row_begin; dy < row_end; dy++)
+    {
+        int y0 = (int)((int64_t)dy * job->src_h / job->dst_h);
+        int y1 = (int)((int64_t)(dy + 1) * job->src_h / job->dst_h);
+        if (y1 <= y0)
+        {
+            y1 = y0 + 1;
+        }
+
+        memset(colsum, 0, stride * sizeof(uint32_t));
+        for (int y = y0; y < y1; y++)
+        {
+            const unsigned char *row = job->src + stride * y;
+            for (size_t i = 0; i < stride; i++)
+            {
+                colsum[i] += row[i];
+            }
+        }
+
+        unsigned char *out = job->dst + (size_t)job->dst_w * ch * dy;
+        for (int dx = 0; dx < job->dst_w; dx++)
+        {
+            int      x0    = xs[dx];
+            int      x1    = xs[dx + 1];
+            uint32_t count = (uint32_t)(x1 - x0) * (y1 - y0);
+            for (int c = 0; c < ch; c++)
+            {
+                uint32_t sum = 0;
+                for (int x = x0; x < x1; x++)
+                {
+                    sum += colsum[x * ch + c];
+                }
+                *out++ = (unsigned char)((sum + count / 2) / count);
+            }
+        }
+    }
+
+    free(colsum);
+}
+
+// area_resize_band() for sources with alpha: colors are summed premultiplied
+// and the uncovered part of every output pixel is filled with the
+// background, which composites while averaging.
+static void area_resize_band_alpha(void *arg, int band)
+{
+    struct resize_job *job = (struct resize_job *)arg;
+    int                row_begin, row_end;
+    band_rows(job, band, &row_begin, &row_end);
+
+    int        ch     = job->channels;
+    int        color  = job->dst_channels;
+    size_t     stride = (size_t)job->src_w * ch;
+    uint64_t  *colsum = (uint64_t *)malloc(stride * sizeof(uint64_t));
+    const int *xs     = job->x_start;
+    int        bg[3];
+    background_channels(job->background, color, bg);
+
+    for (int dy = row_begin; dy < row_end; dy++)
+    {
+        int y0 = (int)((int64_t)dy * job->src_h / job->dst_h);
+        int y1 = (int)((int64_t)(dy + 1) * job->src_h / job->dst_h);
+        if (y1 <= y0)
+        {
+            y1 = y0 + 1;
+        }
+
+        memset(colsum, 0, stride * sizeof(uint64_t));
+        for (int y = y0; y < y1; y++)
+        {
+            const unsigned char *row = job->src + stride * y;
+            for (size_t i = 0; i < stride; i += ch)
+            {
+                int a = row[i + color];
+                for (int c = 0; c < color; c++)
+                {
+                    colsum[i + c] += row[i + c] * a;
+                }
+                colsum[i + color] += a;
+            }
+        }
+
+        unsigned char *out = job->dst + (size_t)job->dst_w * color * dy;
+        for (int dx = 0; dx < job->dst_w; dx++)
+        {
+            int      x0    = xs[dx];
+            int      x1    = xs[dx + 1];
+            uint64_t full  = (uint64_t)255 * (x1 - x0) * (y1 - y0);
+            uint64_t alpha = 0;
+            for (int x = x0; x < x1; x++)
+            {
+                alpha += colsum[x * ch + color];
+            }
+            for (int c = 0; c < color; c++)
+            {
+                uint64_t sum = (uint64_t)bg[c] * (full - alpha);
+                for (int x = x0; x < x1; x++)
+                {
+                    sum += colsum[x * ch + c];
+                }
+                *out++ = (unsigned char)((sum + full / 2) / full);
+            }
+        }
+    }
+
+    free(colsum);
+}
+
+// stbir on one band of output rows: same scale as the whole image, shifted
+// so that the band's first row comes out first. stbir skips the input rows
+// that do not contribute to the band. With alpha, stbir filters
+// premultiplied colors into a band sized buffer that is then composited.
+static void stbir_resize_band(void *arg, int band)
+{
+    struct resize_job *job = (struct resize_job *)arg;
+    int                row_begin, row_end;
+    band_rows(job, band, &row_begin, &row_end);
+    if (row_end <= row_begin)
+    {
+        return;
+    }
+
+    bool           alpha  = job->dst_channels != job->channels;
+    size_t         pixels = (size_t)job->dst_w * (row_end - row_begin);
+    unsigned char *dst = job->dst + (size_t)job->dst_w * job->dst_channels *
+                                        row_begin;
+    unsigned char *out = dst;
+    if (alpha)
+    {
+        out = (unsigned char *)malloc(pixels * job->channels);
+    }
+
+    int r = stbir_resize_subpixel(
+        job->src, job->src_w, job->src_h, 0, out, job->dst_w,
+        row_end - row_begin, 0, STBIR_TYPE_UINT8, job->channels,
+        alpha ? job->channels - 1 : STBIR_ALPHA_CHANNEL_NONE, 0,
+        STBIR_EDGE_CLAMP, STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT,
+        STBIR_FILTER_DEFAULT, STBIR_COLORSPACE_LINEAR, NULL,
+        (float)job->dst_w / job->src_w, (float)job->dst_h / job->src_h, 0.0f,
+        (float)row_begin);
+    if (r == 0)
+    {
+        job->failed = 1;
+    }
+
+    if (alpha)
+    {
+        composite_alpha(out, dst, pixels, job->channels, job->background);
+        free(out);
+    }
+}
+
+// Same size: composite one band of rows straight into dst.
+static void composite_band(void *arg, int band)
+{
+    struct resize_job *job = (struct resize_job *)arg;
+    int                row_begin, row_end;
+    band_rows(job, band, &row_begin, &row_end);
+
+    size_t first = (size_t)job->dst_w * row_begin;
+    composite_alpha(job->src + first * job->channels,
+                    job->dst + first * job->dst_channels,
+                    (size_t)job->dst_w * (row_end - row_begin), job->channels,
+                    job->background);
+}
+
+int resize_image(const unsigned char *src,
+                 int                  src_w,
+                 int                  src_h,
+                 unsigned char       *dst,
+                 int                  dst_w,
+                 int                  dst_h,
+                 int                  channels,
+                 int                  resample,
+                 int                  background)
+{
+    if (resample == PRINT_RESAMPLE_AUTO)
+    {
+        bool large_ratio = src_w >= dst_w * AREA_RESAMPLE_MIN_RATIO &&
+                           src_h >= dst_h * AREA_RESAMPLE_MIN_RATIO;
+        resample = large_ratio ? PRINT_RESAMPLE_AREA : PRINT_RESAMPLE_STBIR;
+    }
+
+    // The box filter can only shrink.
+    if (resample == PRINT_RESAMPLE_AREA && (src_w < dst_w || src_h < dst_h))
+    {
+        resample = PRINT_RESAMPLE_STBIR;
+    }
+
+    struct resize_job job;
+    job.src      = src;
+    job.src_w    = src_w;
+    job.src_h    = src_h;
+    job.dst      = dst;
+    job.dst_w    = dst_w;
+    job.dst_h    = dst_h;
+    job.channels = channels;
+    job.bands    = pool_threads() < dst_h ? pool_threads() : dst_h;
+    job.x_start  = NULL;
+    job.failed   = 0;
+
+    // Two and four channels carry alpha, which is composited away.
+    job.dst_channels = channels % 2 == 0 ? channels - 1 : channels;
+    job.background   = background;
+
+    if (job.dst_channels != channels && src_w == dst_w && src_h == dst_h)
+    {
+        pool_run(job.bands, composite_band, &job);
+        return 1;
+    }
+
+    if (resample == PRINT_RESAMPLE_STBIR)
+    {
+        pool_run(job.bands, stbir_resize_band, &job);
+        return !job.failed;
+    }
+
+    int *xs = (int *)malloc((dst_w + 1) * sizeof(int));
+    for (int dx = 0; dx <= dst_w; dx++)
+    {
+        xs[dx] = (int)((int64_t)dx * src_w / dst_w);
+    }
+    for (int dx = 0; dx < dst_w; dx++)
+    {
+        if (xs[dx + 1] <= xs[dx])
+        {
+            xs[dx + 1] = xs[dx] + 1;
+        }
+    }
+    job.x_start = xs;
+
+    pool_run(job.bands,
+             job.dst_channels != channels ? area_resize_band_alpha
+                                          : area_resize_band,
+             &job);
+
+    free(xs);
+    return 1;
+}
+
+struct yuv_job
+{
+    const unsigned char *y;
+    const unsigned char *u;
+    const unsigned char *v;
+    int                  src_w;
+    int                  src_h;
+    unsigned char       *dst;
+    int                  dst_w;
+    int                  dst_h;
+    int                  channels;  // of dst: 3 (RGB) or 1 (luma)
+    bool                 full_range;
+    int                  bands;
+    const int           *x_start;  // dst_w + 1 luma column boundaries
+};
+
+static unsigned char clamp_byte(int v)
+{
+    return (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+// Average luma and chroma over every output pixel's area, then convert.
+static void yuv420_resize_band(void *arg, int band)
+{
+    struct yuv_job *job       = (struct yuv_job *)arg;
+    int             row_begin = job->dst_h * band / job->bands;
+    int             row_end   = job->dst_h * (band + 1) / job->bands;
+
+    int        chroma_w = (job->src_w + 1) / 2;
+    int        chroma_h = (job->src_h + 1) / 2;
+    uint32_t  *ysum     = (uint32_t *)malloc(job->src_w * sizeof(uint32_t));
+    uint32_t  *usum     = (uint32_t *)malloc(chroma_w * sizeof(uint32_t));
+    uint32_t  *vsum     = (uint32_t *)malloc(chroma_w * sizeof(uint32_t));
+    const int *xs       = job->x_start;
+
+    for (int dy = row_begin; dy < row_end; dy++)
+    {
+        int y0 = (int)((int64_t)dy * job->src_h / job->dst_h);
+        int y1 = (int)((int64_t)(dy + 1) * job->src_h / job->dst_h);
+        if (y1 <= y0)
+        {
+            y1 = y0 + 1;
+        }
+        int cy0 = y0 / 2;
+        int cy1 = (y1 + 1) / 2 < chroma_h ? (y1 + 1) / 2 : chroma_h;
+
+        memset(ysum, 0, job->src_w * sizeof(uint32_t));
+        for (int y = y0; y < y1; y++)
+        {
+            const unsigned char *row = job->y + (size_t)job->src_w * y;
+            for (int x = 0; x < job->src_w; x++)
+            {
+                ysum[x] += row[x];
+            }
+        }
+        memset(usum, 0, chroma_w * sizeof(uint32_t));
+        memset(vsum, 0, chroma_w * sizeof(uint32_t));
+        for (int y = cy0; y < cy1; y++)
+        {
+            const unsigned char *urow = job->u + (size_t)chroma_w * y;
+            const unsigned char *vrow = job->v + (size_t)chroma_w * y;
+            for (int x = 0; x < chroma_w; x++)
+            {
+                usum[x] += urow[x];
+                vsum[x] += vrow[x];
+            }
+        }
+
+        unsigned char *out = job->dst + (size_t)job->dst_w * job->channels * dy;
+        for (int dx = 0; dx < job->dst_w; dx++)
+        {
+            int      x0     = xs[dx];
+            int      x1     = xs[dx + 1];
+            int      cx0    = x0 / 2;
+            int      cx1    = (x1 + 1) / 2 < chroma_w ? (x1 + 1) / 2 : chroma_w;
+            uint32_t count  = (uint32_t)(x1 - x0) * (y1 - y0);
+            uint32_t ccount = (uint32_t)(cx1 - cx0) * (cy1 - cy0);
+            uint32_t lum    = 0;
+            uint32_t cb     = 0;
+            uint32_t cr     = 0;
+            for (int x = x0; x < x1; x++)
+            {
+                lum += ysum[x];
+            }
+            for (int x = cx0; x < cx1; x++)
+            {
+                cb += usum[x];
+                cr += vsum[x];
+            }
+
+            int c = (int)((lum + count / 2) / count);
+            int d = (int)((cb + ccount / 2) / ccount) - 128;
+            int e = (int)((cr + ccount / 2) / ccount) - 128;
+            if (job->full_range)
+            {
+                c *= 256;
+            }
+            else
+            {
+                c = (c - 16) * 298;
+            }
+
+            if (job->channels == 1)
+            {
+                *out++ = clamp_byte((c + 128) >> 8);
+            }
+            else if (job->full_range)
+            {
+                *out++ = clamp_byte((c + 359 * e + 128) >> 8);
+                *out++ = clamp_byte((c - 88 * d - 183 * e + 128) >> 8);
+                *out++ = clamp_byte((c + 454 * d + 128) >> 8);
+            }
+            else
+            {
+                *out++ = clamp_byte((c + 409 * e + 128) >> 8);
+                *out++ = clamp_byte((c - 100 * d - 208 * e + 128) >> 8);
+                *out++ = clamp_byte((c + 516 * d + 128) >> 8);
+            }
+        }
+    }
+
+    free(ysum);
+    free(usum);
+    free(vsum);
+}
+
+void resize_yuv420(const unsigned char *y,
+                   const unsigned char *u,
+                   const unsigned char *v,
+                   int                  src_w,
+                   int                  src_h,
+                   unsigned char       *dst,
+                   int                  dst_w,
+                   int                  dst_h,
+                   int                  channels,
+                   bool                 full_range)
+{
+    int *xs = (int *)malloc((dst_w + 1) * sizeof(int));
+    for (int dx = 0; dx <= dst_w; dx++)
+    {
+        xs[dx] = (int)((int64_t)dx * src_w / dst_w);
+    }
+
+    struct yuv_job job;
+    job.y          = y;
+    job.u          = u;
+    job.v          = v;
+    job.src_w      = src_w;
+    job.src_h      = src_h;
+    job.dst        = dst;
+    job.dst_w      = dst_w;
+    job.dst_h      = dst_h;
+    job.channels   = channels;
+    job.full_range = full_range;
+    job.bands      = pool_threads() < dst_h ? pool_threads() : dst_h;
+    job.x_start    = xs;
+
+    pool_run(job.bands, yuv420_resize_band, &job);
+    free(xs);
+}
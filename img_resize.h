@@ -0,0 +1,43 @@
+#ifndef _IMG_RESIZE_H
+#define _IMG_RESIZE_H
+
+#include <stddef.h>
+
+// Resize packed 8-bit pixels with the given PRINT_RESAMPLE_* method.
+// PRINT_RESAMPLE_AUTO uses an integer area average for large reduction
+// ratios and stbir otherwise. Sources with alpha (2 or 4 channels) come out
+// without it, composited onto background (0xRRGGBB) as part of the resize.
+// Returns 0 on failure.
+int resize_image(const unsigned char *src,
+                 int                  src_w,
+                 int                  src_h,
+                 unsigned char       *dst,
+                 int                  dst_w,
+                 int                  dst_h,
+                 int                  channels,
+                 int                  resample,
+                 int                  background);
+
+// Planar YUV 4:2:0 (BT.601) to packed RGB, or to luma with channels 1,
+// area averaged down to dst_w x dst_h, which must not exceed the source.
+// Chroma is averaged over the same area, so the conversion runs once per
+// output pixel. full_range selects 0-255 (JPEG) levels instead of 16-235.
+void resize_yuv420(const unsigned char *y,
+                   const unsigned char *u,
+                   const unsigned char *v,
+                   int                  src_w,
+                   int                  src_h,
+                   unsigned char       *dst,
+                   int                  dst_w,
+                   int                  dst_h,
+                   int                  channels,
+                   bool                 full_range);
+
+// Blend pixels with alpha in their last channel onto background, dropping
+// the alpha channel. dst may be src.
+void composite_alpha(const unsigned char *src,
+                     unsigned char       *dst,
+                     size_t               pixels,
+                     int                  channels,
+                     int                  background);
+#endif
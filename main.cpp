@@ -1,9 +1,146 @@
+#include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <termios.h>
 #include <unistd.h>
 
+#include "daemon.h"
 #include "print_img.h"
+#include "record.h"
+#include "resident.h"
+#include "video.h"
+
+// Ask the terminal for its default background with OSC 11. The reply looks
+// like ESC ] 11 ; rgb:RRRR/GGGG/BBBB with 1 to 4 hex digits per channel.
+// Returns -1 when there is no terminal or it does not answer in time.
+static int query_term_background(void)
+{
+    int fd = open("/dev/tty", O_RDWR | O_NOCTTY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct termios saved, raw;
+    if (tcgetattr(fd, &saved) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    tcsetattr(fd, TCSANOW, &raw);
+
+    const char query[] = "\033]11;?\033\\";
+    char       reply[64];
+    size_t     len = 0;
+    if (write(fd, query, sizeof(query) - 1) == (ssize_t)sizeof(query) - 1)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        while (len < sizeof(reply) - 1 && poll(&pfd, 1, 100) > 0)
+        {
+            ssize_t n = read(fd, reply + len, sizeof(reply) - 1 - len);
+            if (n <= 0)
+            {
+                break;
+            }
+            len += n;
+            if (memchr(reply, '\a', len) != NULL ||
+                memchr(reply, '\\', len) != NULL)
+            {
+                break;
+            }
+        }
+    }
+    tcsetattr(fd, TCSANOW, &saved);
+    close(fd);
+    reply[len] = '\0';
+
+    const char *p = strstr(reply, "rgb:");
+    if (p == NULL)
+    {
+        return -1;
+    }
+    p += 4;
+
+    int color = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        char         *end;
+        unsigned long v      = strtoul(p, &end, 16);
+        int           digits = (int)(end - p);
+        if (digits < 1 || digits > 4 || (i < 2 && *end != '/'))
+        {
+            return -1;
+        }
+        color = (color << 8) | (int)(v * 255 / ((1ul << (4 * digits)) - 1));
+        p     = end + 1;
+    }
+    return color;
+}
+
+// RRGGBB or #RRGGBB, or "term" for the terminal's own background (black if
+// it does not tell). -1 when arg is neither.
+static int parse_background(const char *arg)
+{
+    if (0 == strcmp(arg, "term"))
+    {
+        int color = query_term_background();
+        return color < 0 ? 0 : color;
+    }
+    if (*arg == '#')
+    {
+        arg++;
+    }
+
+    char *end;
+    long  color = strtol(arg, &end, 16);
+    if (end - arg != 6 || *end != '\0')
+    {
+        return -1;
+    }
+    return (int)color;
+}
+
+// Parse a comma separated list of terminal features ("rep,ech"). -1 when it
+// names a feature we do not know.
+static int parse_term_caps(const char *list)
+{
+    int caps = 0;
+    if (list == NULL)
+    {
+        return 0;
+    }
+
+    char buf[64];
+    if (strlen(list) >= sizeof(buf))
+    {
+        return -1;
+    }
+    strcpy(buf, list);
+
+    char *save;
+    for (char *cap = strtok_r(buf, ",", &save); cap != NULL;
+         cap = strtok_r(NULL, ",", &save))
+    {
+        if (0 == strcmp(cap, "rep"))
+        {
+            caps |= PRINT_CAP_REP;
+        }
+        else if (0 == strcmp(cap, "ech"))
+        {
+            caps |= PRINT_CAP_ECH;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    return caps;
+}
 
 unsigned int get_file_size(FILE *fp)
 {
@@ -21,16 +158,43 @@ static int usage(const char *arg0, int code)
     printf(
         "Usage:\n"
         "  %s [OPTIONS] img_path\n"
+        "  %s -D\n"
+        "  %s -v format < frames\n"
+        "  %s -P recording\n"
         "\n"
         "Options:\n"
         "  -w width   resize to opt width\n"
         "  -h height  resize to opt height\n"
         "  -c         print image in compat mode\n"
+        "  -k         print image with the kitty graphics protocol\n"
+        "  -m mode    output mode: block (default), compat, kitty, braille,\n"
+        "             octant or ascii\n"
+        "  -r method  resampler: auto (default), stbir or area\n"
+        "  -p         draw a coarse preview first, then refine\n"
+        "  -C dir     cache rendered output in dir ($PIMG_CACHE_DIR)\n"
+        "  -R         stay resident, redraw on terminal resize, q to quit\n"
+        "  -V         interactive viewer: arrows/hjkl pan, +/- zoom, q quits\n"
+        "  -F fps     viewer: adapt quality to hold fps on slow links\n"
+        "  -H margin  viewer: keep a cell unless the new one is this much\n"
+        "             closer (mean difference per channel)\n"
+        "  -g glyphs  glyph set: full (default), blocks, half or sextant\n"
+        "  -8         use the 256-color palette\n"
+        "  -e caps    terminal supports rep,ech ($PIMG_TERM_CAPS)\n"
+        "  -b color   background under transparent pixels: RRGGBB (default\n"
+        "             000000) or term\n"
+        "  -x stops   exposure for HDR images before tone mapping\n"
+        "  -D         run a render daemon on $PIMG_SOCKET (default\n"
+        "             $XDG_RUNTIME_DIR/pimg.sock)\n"
+        "  -S         render through the daemon, locally if it is not running\n"
+        "  -v format  play video from stdin: y4m (4:2:0) or rgb24:WxH; pace\n"
+        "             files with ffmpeg -re, -F and -H apply\n"
+        "  -o file    record the frames of -R, -V or -v to file\n"
+        "  -P file    replay a recording at its recorded pace\n"
         "\n"
         "Arguments:\n"
         "  img_path   image to print\n"
         "\n",
-        arg0);
+        arg0, arg0, arg0, arg0);
 
     return code;
 }
@@ -41,34 +205,222 @@ int main(int argc, char *argv[])
     {
         return usage(argv[0], -1);
     }
-    else if (0 != access(argv[argc - 1], F_OK))
+
+    print_img_opts_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.mode     = PRINT_MODE_BLOCK;
+    opts.resample  = PRINT_RESAMPLE_AUTO;
+    opts.cache_dir = getenv("PIMG_CACHE_DIR");
+    opts.term_caps = parse_term_caps(getenv("PIMG_TERM_CAPS"));
+    if (opts.term_caps < 0)
     {
-        return usage(argv[0], -1);
+        return usage(argv[0], 1);
     }
 
-    unsigned int opt_width  = 0;
-    unsigned int opt_height = 0;
-    int          compat     = 0;
+    bool   resident = false;
+    bool   viewer   = false;
+    bool   daemon   = false;
+    bool   client   = false;
+    int    video    = -1;
+    int    video_w  = 0;
+    int    video_h  = 0;
+    char  *record   = NULL;
+    char  *replay   = NULL;
+    double fps      = 0;
 
     int c;
-    while ((c = getopt(argc, argv, "w:h:c")) != EOF)
+    while ((c = getopt(argc, argv,
+                       "w:h:ckm:r:pC:RVF:H:g:8e:b:x:DSv:o:P:")) != EOF)
     {
         switch (c)
         {
             case 'w':
-                opt_width = (unsigned int)atoi(optarg);
+                opts.width = (unsigned int)atoi(optarg);
                 break;
             case 'h':
-                opt_height = (unsigned int)atoi(optarg);
+                opts.height = (unsigned int)atoi(optarg);
                 break;
             case 'c':
-                compat = 1;
+                opts.mode = PRINT_MODE_COMPAT;
+                break;
+            case 'k':
+                opts.mode = PRINT_MODE_KITTY;
+                break;
+            case 'm':
+                if (0 == strcmp(optarg, "block"))
+                {
+                    opts.mode = PRINT_MODE_BLOCK;
+                }
+                else if (0 == strcmp(optarg, "compat"))
+                {
+                    opts.mode = PRINT_MODE_COMPAT;
+                }
+                else if (0 == strcmp(optarg, "kitty"))
+                {
+                    opts.mode = PRINT_MODE_KITTY;
+                }
+                else if (0 == strcmp(optarg, "braille"))
+                {
+                    opts.mode = PRINT_MODE_BRAILLE;
+                }
+                else if (0 == strcmp(optarg, "octant"))
+                {
+                    opts.mode = PRINT_MODE_OCTANT;
+                }
+                else if (0 == strcmp(optarg, "ascii"))
+                {
+                    opts.mode = PRINT_MODE_ASCII;
+                }
+                else
+                {
+                    return usage(argv[0], 1);
+                }
+                break;
+            case 'C':
+                opts.cache_dir = optarg;
+                break;
+            case 'R':
+                resident = true;
+                break;
+            case 'V':
+                viewer = true;
+                break;
+            case 'D':
+                daemon = true;
+                break;
+            case 'S':
+                client = true;
+                break;
+            case 'v':
+                if (0 == strcmp(optarg, "y4m"))
+                {
+                    video = PRINT_VIDEO_Y4M;
+                }
+                else if (2 == sscanf(optarg, "rgb24:%dx%d", &video_w,
+                                     &video_h) &&
+                         video_w > 0 && video_h > 0)
+                {
+                    video = PRINT_VIDEO_RGB24;
+                }
+                else
+                {
+                    return usage(argv[0], 1);
+                }
+                break;
+            case 'o':
+                record = optarg;
+                break;
+            case 'P':
+                replay = optarg;
+                break;
+            case 'F':
+                fps = atof(optarg);
+                break;
+            case 'e':
+                opts.term_caps = parse_term_caps(optarg);
+                if (opts.term_caps < 0)
+                {
+                    return usage(argv[0], 1);
+                }
+                break;
+            case 'H':
+                opts.hysteresis = atoi(optarg);
+                break;
+            case 'x':
+                opts.exposure = (float)atof(optarg);
+                break;
+            case 'b':
+                opts.background = parse_background(optarg);
+                if (opts.background < 0)
+                {
+                    return usage(argv[0], 1);
+                }
+                break;
+            case '8':
+                opts.colors = PRINT_COLORS_256;
+                break;
+            case 'g':
+                if (0 == strcmp(optarg, "full"))
+                {
+                    opts.glyphs = PRINT_GLYPHS_FULL;
+                }
+                else if (0 == strcmp(optarg, "blocks"))
+                {
+                    opts.glyphs = PRINT_GLYPHS_BLOCKS;
+                }
+                else if (0 == strcmp(optarg, "half"))
+                {
+                    opts.glyphs = PRINT_GLYPHS_HALF;
+                }
+                else if (0 == strcmp(optarg, "sextant"))
+                {
+                    opts.glyphs = PRINT_GLYPHS_SEXTANT;
+                }
+                else
+                {
+                    return usage(argv[0], 1);
+                }
+                break;
+            case 'p':
+                opts.progressive = 1;
+                break;
+            case 'r':
+                if (0 == strcmp(optarg, "auto"))
+                {
+                    opts.resample = PRINT_RESAMPLE_AUTO;
+                }
+                else if (0 == strcmp(optarg, "stbir"))
+                {
+                    opts.resample = PRINT_RESAMPLE_STBIR;
+                }
+                else if (0 == strcmp(optarg, "area"))
+                {
+                    opts.resample = PRINT_RESAMPLE_AREA;
+                }
+                else
+                {
+                    return usage(argv[0], 1);
+                }
                 break;
             default:
                 return usage(argv[0], 1);
         }
     }
 
+    char socket_path[256];
+    print_img_socket_path(socket_path, sizeof(socket_path));
+    if (daemon)
+    {
+        return print_img_daemon(socket_path) == 0 ? 0 : 1;
+    }
+    if (replay != NULL)
+    {
+        return print_img_replay(replay, STDOUT_FILENO) == 0 ? 0 : 1;
+    }
+
+    if (video < 0 && (optind >= argc || 0 != access(argv[argc - 1], F_OK)))
+    {
+        return usage(argv[0], -1);
+    }
+
+    if (record != NULL && print_img_record_start(record) != 0)
+    {
+        return 1;
+    }
+    if (video >= 0)
+    {
+        int ret = print_img_video(STDIN_FILENO, video, video_w, video_h,
+                                  &opts, fps);
+        print_img_record_stop();
+        return ret == 0 ? 0 : 1;
+    }
+
+    if (client && !viewer && !resident &&
+        print_img_client(socket_path, argv[argc - 1], &opts) == 0)
+    {
+        return 0;
+    }
+
     FILE    *fp  = fopen(argv[argc - 1], "rb");
     uint32_t len = get_file_size(fp);
 
@@ -76,7 +428,19 @@ int main(int argc, char *argv[])
     fread(data, len, 1, fp);
     fclose(fp);
 
-    print_img((unsigned char *)data, len, opt_width, opt_height, compat);
+    if (viewer)
+    {
+        print_img_viewer((unsigned char *)data, len, &opts, fps);
+    }
+    else if (resident)
+    {
+        print_img_resident((unsigned char *)data, len, &opts);
+    }
+    else
+    {
+        print_img_ex((unsigned char *)data, len, &opts);
+    }
+    print_img_record_stop();
 
     free(data);
 
@@ -0,0 +1,107 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "outbuf.h"
+
+#define OUTBUF_MIN_CAPACITY 4096
+
+void outbuf_init(outbuf_t *ob)
+{
+    ob->data = NULL;
+    ob->len  = 0;
+    ob->cap  = 0;
+}
+
+void outbuf_free(outbuf_t *ob)
+{
+    free(ob->data);
+    outbuf_init(ob);
+}
+
+void outbuf_reserve(outbuf_t *ob, size_t extra)
+{
+    if (ob->len + extra <= ob->cap)
+    {
+        return;
+    }
+
+    size_t cap = ob->cap < OUTBUF_MIN_CAPACITY ? OUTBUF_MIN_CAPACITY : ob->cap;
+    while (cap < ob->len + extra)
+    {
+        cap *= 2;
+    }
+    ob->data = (char *)realloc(ob->data, cap);
+    ob->cap  = cap;
+}
+
+void outbuf_write(outbuf_t *ob, const void *data, size_t len)
+{
+    outbuf_reserve(ob, len);
+    memcpy(ob->data + ob->len, data, len);
+    ob->len += len;
+}
+
+void outbuf_puts(outbuf_t *ob, const char *str)
+{
+    outbuf_write(ob, str, strlen(str));
+}
+
+void outbuf_printf(outbuf_t *ob, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+    {
+        return;
+    }
+
+    outbuf_reserve(ob, (size_t)n + 1);
+    va_start(ap, fmt);
+    vsnprintf(ob->data + ob->len, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    ob->len += n;
+}
+
+void outbuf_put_dec(outbuf_t *ob, unsigned int value, int min_digits)
+{
+    char digits[3];
+    int  n = value >= 100 ? 3 : (value >= 10 ? 2 : 1);
+    if (n < min_digits)
+    {
+        n = min_digits;
+    }
+
+    outbuf_reserve(ob, n);
+    for (int i = n - 1; i >= 0; i--)
+    {
+        digits[i] = (char)('0' + value % 10);
+        value /= 10;
+    }
+    memcpy(ob->data + ob->len, digits, n);
+    ob->len += n;
+}
+
+int outbuf_flush_fd(const outbuf_t *ob, int fd)
+{
+    size_t done = 0;
+    while (done < ob->len)
+    {
+        ssize_t n = write(fd, ob->data + done, ob->len - done);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef _OUTBUF_H
+#define _OUTBUF_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Growable byte buffer that a whole frame is encoded into before it is
+// written out in one go (or cached, or sent elsewhere).
+typedef struct
+{
+    char  *data;
+    size_t len;
+    size_t cap;
+} outbuf_t;
+
+void outbuf_init(outbuf_t *ob);
+void outbuf_free(outbuf_t *ob);
+void outbuf_reserve(outbuf_t *ob, size_t extra);
+void outbuf_write(outbuf_t *ob, const void *data, size_t len);
+void outbuf_puts(outbuf_t *ob, const char *str);
+void outbuf_printf(outbuf_t *ob, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Append the decimal form of 0 <= value <= 999, at least min_digits wide.
+void outbuf_put_dec(outbuf_t *ob, unsigned int value, int min_digits);
+
+// Write the whole buffer to fd, retrying on short writes. Returns 0 or -1.
+int outbuf_flush_fd(const outbuf_t *ob, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -2,12 +2,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <termios.h>
 #include <unistd.h>
 
 #include <sys/ioctl.h>
@@ -18,10 +20,15 @@
 #define MULTI_THREAD_TRANSFORM
 //#define USING_CPP_MAP
 
-#define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include "stb/stb_image_resize.h"
+
+#include "img_decode.h"
+#include "img_resize.h"
+#include "outbuf.h"
+#include "print_img.h"
+#include "render_cache.h"
+#include "worker_pool.h"
+#include "writer.h"
 
 #ifdef USING_CPP_MAP
 #include <map>
@@ -30,12 +37,36 @@
 #define TERM_PADDING_X 8
 #define TERM_PADDING_Y 4
 
-static void get_term_size(int *width, int *height)
+#define TERM_MAX_COLS 400
+#define TERM_MAX_ROWS 120
+
+struct render_geometry
+{
+    unsigned int width;  // output size in pixels
+    unsigned int height;
+    int          cell_w;  // pixels per character cell
+    int          cell_h;
+};
+
+// The terminal the output is for: the one given in opts (e.g. by a daemon
+// client), else stdout.
+static bool get_winsize(const print_img_opts_t *opts, struct winsize *w)
+{
+    if (opts->term_cols > 0 && opts->term_rows > 0)
+    {
+        w->ws_col    = (unsigned short)opts->term_cols;
+        w->ws_row    = (unsigned short)opts->term_rows;
+        w->ws_xpixel = (unsigned short)opts->term_xpixel;
+        w->ws_ypixel = (unsigned short)opts->term_ypixel;
+        return true;
+    }
+    return ioctl(STDOUT_FILENO, TIOCGWINSZ, w) == 0;
+}
+
+static void get_term_size(const print_img_opts_t *opts, int *width, int *height)
 {
     struct winsize w;
-    int            ret;
-    ret = ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-    if (ret != 0 || (w.ws_col | w.ws_row) == 0)
+    if (!get_winsize(opts, &w) || (w.ws_col | w.ws_row) == 0)
     {
         *height = 24;
         *width  = 80;
@@ -45,21 +76,39 @@ static void get_term_size(int *width, int *height)
     *height = (int)w.ws_row;
     *width  = (int)w.ws_col;
 
-    if (*height > 120)
+    if (*height > TERM_MAX_ROWS)
+    {
+        *height = TERM_MAX_ROWS;
+    }
+    if (*width > TERM_MAX_COLS)
     {
-        *height = 120;
+        *width = TERM_MAX_COLS;
     }
-    if (*width > 400)
+}
+
+// Size of one character cell in pixels, if the terminal reports it.
+static bool get_term_cell_size(const print_img_opts_t *opts,
+                               int                    *cell_w,
+                               int                    *cell_h)
+{
+    struct winsize w;
+    if (!get_winsize(opts, &w) || w.ws_col == 0 || w.ws_row == 0 ||
+        w.ws_xpixel == 0 || w.ws_ypixel == 0)
     {
-        *width = 400;
+        return false;
     }
+
+    *cell_w = (int)(w.ws_xpixel / w.ws_col);
+    *cell_h = (int)(w.ws_ypixel / w.ws_row);
+    return *cell_w > 0 && *cell_h > 0;
 }
 
-static void get_ideal_image_size(int      *width,
-                                 int      *height,
-                                 const int image_width,
-                                 const int image_height,
-                                 int       squashing_enabled)
+static void get_ideal_image_size(int                    *width,
+                                 int                    *height,
+                                 const int               image_width,
+                                 const int               image_height,
+                                 int                     squashing_enabled,
+                                 const print_img_opts_t *opts)
 {
     *width              = squashing_enabled
                               ? image_width * 2
@@ -68,10 +117,12 @@ static void get_ideal_image_size(int      *width,
     double aspect_ratio = (double)*width / (double)*height;
 
     int term_w, term_h;
-    get_term_size(&term_w, &term_h);
+    get_term_size(opts, &term_w, &term_h);
 
     term_h -= TERM_PADDING_Y;  // Some offsets for screen padding.
     term_w -= TERM_PADDING_X;
+    term_h = term_h < 1 ? 1 : term_h;
+    term_w = term_w < 1 ? 1 : term_w;
 
     bool solving = true;
 
@@ -93,11 +144,43 @@ static void get_ideal_image_size(int      *width,
             solving = true;
         }
     }
+
+    // The padding steps can overshoot on a tiny terminal.
+    *width  = *width < 1 ? 1 : *width;
+    *height = *height < 1 ? 1 : *height;
+}
+
+// Nearest entry of the xterm 256-color palette: the 6x6x6 color cube
+// (16..231) or the 24 step gray ramp (232..255).
+static int cube_level(int v)
+{
+    return v < 48 ? 0 : (v < 115 ? 1 : (v - 35) / 40);
+}
+
+static int rgb_to_ansi256(int r, int g, int b)
+{
+    int ri = cube_level(r), gi = cube_level(g), bi = cube_level(b);
+    int cr = ri ? 55 + 40 * ri : 0;
+    int cg = gi ? 55 + 40 * gi : 0;
+    int cb = bi ? 55 + 40 * bi : 0;
+
+    int gray = (r + g + b) / 3;
+    int gi24 = gray < 8 ? 0 : (gray > 238 ? 23 : (gray - 8) / 10);
+    int gv   = 8 + 10 * gi24;
+
+    int cube_d =
+        (r - cr) * (r - cr) + (g - cg) * (g - cg) + (b - cb) * (b - cb);
+    int gray_d =
+        (r - gv) * (r - gv) + (g - gv) * (g - gv) + (b - gv) * (b - gv);
+
+    return gray_d < cube_d ? 232 + gi24 : 16 + 36 * ri + 6 * gi + bi;
 }
 
-static int print_rgb_rawdata_compat(unsigned char *rgbraw,
+static int print_rgb_rawdata_compat(outbuf_t      *out,
+                                    unsigned char *rgbraw,
                                     unsigned int   width,
-                                    unsigned int   height)
+                                    unsigned int   height,
+                                    int            colors)
 {
     typedef struct
     {
@@ -111,15 +194,28 @@ static int print_rgb_rawdata_compat(unsigned char *rgbraw,
     {
         if (d % width == 0 && d != 0)
         {
-            printf("\033[0m");
-            printf("\n");
+            outbuf_puts(out, "\033[0m");
+            outbuf_puts(out, "\n");
         }
 
         pxcolor_t *c = px + d;
-        printf("\033[48;2;%03u;%03u;%03um ", c->r, c->g, c->b);
+        if (colors == PRINT_COLORS_256)
+        {
+            outbuf_puts(out, "\033[48;5;");
+            outbuf_put_dec(out, rgb_to_ansi256(c->r, c->g, c->b), 1);
+            outbuf_puts(out, "m ");
+            continue;
+        }
+        outbuf_puts(out, "\033[48;2;");
+        outbuf_put_dec(out, c->r, 3);
+        outbuf_puts(out, ";");
+        outbuf_put_dec(out, c->g, 3);
+        outbuf_puts(out, ";");
+        outbuf_put_dec(out, c->b, 3);
+        outbuf_puts(out, "m ");
     }
-    printf("\033[0m");
-    printf("\n");
+    outbuf_puts(out, "\033[0m");
+    outbuf_puts(out, "\n");
     return 0;
 }
 
@@ -211,44 +307,51 @@ static const unsigned int BITMAPS[] = {
     // 0x000fec80, 0x25e4,
     // 0x000f7310, 0x25e5,
 
-    0, 0,  // End marker for "regular" characters
-
-    // Teletext / legacy graphics 3x2 block character codes.
-    // Using a 3-2-3 pattern consistently, perhaps we should create automatic
-    // variations....
-
-    0xccc00000, 0xfb00, 0x33300000, 0xfb01, 0xfff00000, 0xfb02, 0x000cc000,
-    0xfb03, 0xccccc000, 0xfb04, 0x333cc000, 0xfb05, 0xfffcc000, 0xfb06,
-    0x00033000, 0xfb07, 0xccc33000, 0xfb08, 0x33333000, 0xfb09, 0xfff33000,
-    0xfb0a, 0x000ff000, 0xfb0b, 0xcccff000, 0xfb0c, 0x333ff000, 0xfb0d,
-    0xfffff000, 0xfb0e, 0x00000ccc, 0xfb0f,
-
-    0xccc00ccc, 0xfb10, 0x33300ccc, 0xfb11, 0xfff00ccc, 0xfb12, 0x000ccccc,
-    0xfb13, 0x333ccccc, 0xfb14, 0xfffccccc, 0xfb15, 0x00033ccc, 0xfb16,
-    0xccc33ccc, 0xfb17, 0x33333ccc, 0xfb18, 0xfff33ccc, 0xfb19, 0x000ffccc,
-    0xfb1a, 0xcccffccc, 0xfb1b, 0x333ffccc, 0xfb1c, 0xfffffccc, 0xfb1d,
-    0x00000333, 0xfb1e, 0xccc00333, 0xfb1f,
+    0, 0,  // End marker
+};
 
-    0x33300333, 0x1b20, 0xfff00333, 0x1b21, 0x000cc333, 0x1b22, 0xccccc333,
-    0x1b23, 0x333cc333, 0x1b24, 0xfffcc333, 0x1b25, 0x00033333, 0x1b26,
-    0xccc33333, 0x1b27, 0xfff33333, 0x1b28, 0x000ff333, 0x1b29, 0xcccff333,
-    0x1b2a, 0x333ff333, 0x1b2b, 0xfffff333, 0x1b2c, 0x00000fff, 0x1b2d,
-    0xccc00fff, 0x1b2e, 0x33300fff, 0x1b2f,
+// A cell drawn in its background color only (no-break space).
+#define BLANK_CODEPOINT 0x00a0
 
-    0xfff00fff, 0x1b30, 0x000ccfff, 0x1b31, 0xcccccfff, 0x1b32, 0x333ccfff,
-    0x1b33, 0xfffccfff, 0x1b34, 0x00033fff, 0x1b35, 0xccc33fff, 0x1b36,
-    0x33333fff, 0x1b37, 0xfff33fff, 0x1b38, 0x000fffff, 0x1b39, 0xcccfffff,
-    0x1b3a, 0x333fffff, 0x1b3b,
+typedef struct
+{
+    int          fg_color[3];
+    int          bg_color[3];
+    int          codepoint;
+    unsigned int pattern;  // pixels of the 4x8 cell drawn in fg_color
+} chardata_t;
 
-    0, 1  // End marker for extended TELETEXT mode.
+// Cells as they were last drawn on screen.
+struct print_img_frame
+{
+    chardata_t *cells;
+    int         char_width;
+    int         char_height;
+
+    // Transform results of the last frame, keyed by a hash of the source
+    // block, valid for the same layout, glyph set and hysteresis margin.
+    uint64_t   *block_hash;
+    chardata_t *block_cell;
+    int         block_width;
+    int         block_height;
+    int         block_glyphs;
+    int         block_margin;
 };
 
-typedef struct
+// Whether the glyph set allows a BITMAPS code point.
+static inline bool glyph_allowed(int glyphs, unsigned int codepoint)
 {
-    int fg_color[3];
-    int bg_color[3];
-    int codepoint;
-} chardata_t;
+    switch (glyphs)
+    {
+        case PRINT_GLYPHS_BLOCKS:
+            return codepoint == 0x00a0 ||
+                   (codepoint >= 0x2580 && codepoint <= 0x259f);
+        case PRINT_GLYPHS_HALF:
+            return codepoint == 0x00a0 || codepoint == 0x2584;
+        default:
+            return true;
+    }
+}
 
 #define cstd_max(a, b)          \
     ({                          \
@@ -266,14 +369,120 @@ typedef struct
 
 static inline int cstd_bitcount(unsigned int n)
 {
-    int count = 0;
-    while (n)
+    return __builtin_popcount(n);
+}
+
+// Teletext style 3x2 sextants (U+1FB00..U+1FB3B) split the 4x8 cell into
+// rows of 3, 2 and 3 pixels and columns of 2. Every region is matched on its
+// own, so the best of all 64 sextants is a majority vote per region rather
+// than a search: sextant bit i is set when most pixels of SEXTANT_REGIONS[i]
+// are set.
+static const unsigned int SEXTANT_REGIONS[6] = {
+    0xccc00000, 0x33300000,  // upper left, upper right
+    0x000cc000, 0x00033000,  // middle left, middle right
+    0x00000ccc, 0x00000333,  // lower left, lower right
+};
+static const int SEXTANT_SIZES[6] = {6, 6, 4, 4, 6, 6};
+
+#define SEXTANT_LEFT  0x15  // left half, U+258C
+#define SEXTANT_RIGHT 0x2a  // right half, inverted U+258C
+#define SEXTANT_FULL  0x3f
+
+// Find the sextant closest to the cell bitmap. Returns the number of
+// mismatching pixels, or 32 when the closest shape is a space or a half
+// block, which the regular glyphs already cover.
+static int match_sextant(unsigned int  bits,
+                         unsigned int *pattern,
+                         int          *codepoint)
+{
+    int          index = 0;
+    int          diff  = 0;
+    unsigned int shape = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        int on = cstd_bitcount(bits & SEXTANT_REGIONS[i]);
+        if (on * 2 > SEXTANT_SIZES[i])
+        {
+            index |= 1 << i;
+            shape |= SEXTANT_REGIONS[i];
+            diff += SEXTANT_SIZES[i] - on;
+        }
+        else
+        {
+            diff += on;
+        }
+    }
+
+    if (index == 0 || index == SEXTANT_FULL || index == SEXTANT_LEFT ||
+        index == SEXTANT_RIGHT)
+    {
+        return 32;
+    }
+
+    // The block skips the four shapes above, in index order.
+    *pattern   = shape;
+    *codepoint = 0x1fb00 + index - 1 - (index > SEXTANT_LEFT) -
+                 (index > SEXTANT_RIGHT);
+    return diff;
+}
+
+// Every regular BITMAPS pattern and its inverse, hashed to the entry the scan
+// in find_chardata settles on when a cell matches it exactly: the first in
+// scan order, the plain pattern before its inverse. Slots hold the BITMAPS
+// index plus one, negated for an inverse; 0 is free.
+#define EXACT_SLOTS 512
+
+static unsigned int EXACT_KEYS[EXACT_SLOTS];
+static int          EXACT_ENTRIES[EXACT_SLOTS];
+
+static inline unsigned int exact_slot(unsigned int bits)
+{
+    return (bits * 0x9e3779b1u) >> 23;
+}
+
+static void build_exact_table(void)
+{
+    for (int i = 0; BITMAPS[i + 1] != 0; i += 2)
+    {
+        if (BITMAPS[i + 1] < 32)
+        {
+            continue;
+        }
+        unsigned int pattern = BITMAPS[i];
+        for (int j = 0; j < 2; j++, pattern = ~pattern)
+        {
+            unsigned int slot = exact_slot(pattern);
+            while (EXACT_ENTRIES[slot] != 0 && EXACT_KEYS[slot] != pattern)
+            {
+                slot = (slot + 1) % EXACT_SLOTS;
+            }
+            if (EXACT_ENTRIES[slot] == 0)
+            {
+                EXACT_KEYS[slot]    = pattern;
+                EXACT_ENTRIES[slot] = j == 0 ? i + 1 : -(i + 1);
+            }
+        }
+    }
+}
+
+// BITMAPS index of the entry matching bits exactly, with *inverted set when
+// it is the inverse that matches. -1 when no glyph draws bits as they are.
+static int find_exact_pattern(unsigned int bits, bool *inverted)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, build_exact_table);
+
+    unsigned int slot = exact_slot(bits);
+    for (; EXACT_ENTRIES[slot] != 0; slot = (slot + 1) % EXACT_SLOTS)
     {
-        if (n & 1)
-            count++;
-        n = n >> 1;
+        if (EXACT_KEYS[slot] == bits)
+        {
+            int entry = EXACT_ENTRIES[slot];
+            *inverted = entry < 0;
+            return (entry < 0 ? -entry : entry) - 1;
+        }
     }
-    return count;
+    return -1;
 }
 
 // Return a chardata struct with the given code point and corresponding averag
@@ -289,6 +498,7 @@ static chardata_t create_chardata(unsigned char *rgbraw,
     chardata_t result;
     memset(&result, 0, sizeof(chardata_t));
     result.codepoint         = codepoint;
+    result.pattern           = pattern;
     int          fg_count    = 0;
     int          bg_count    = 0;
     unsigned int mask        = 0x80000000;
@@ -339,7 +549,8 @@ static chardata_t find_chardata(unsigned char *rgbraw,
                                 int            x0,
                                 int            y0,
                                 int            width,
-                                int            height)
+                                int            height,
+                                int            glyphs)
 {
     int min[3]      = {255, 255, 255};
     int max[3]      = {0};
@@ -386,7 +597,11 @@ static chardata_t find_chardata(unsigned char *rgbraw,
     unsigned int bits   = 0;
     bool         direct = count2 > (8 * 4) / 2;
 #else
-    // Determine the minimum and maximum value for each color channel
+    // Determine the minimum and maximum value for each color channel, and
+    // whether the block has no more than two distinct colors.
+    long colors[2]  = {-1, -1};
+    int  counts[2]  = {0, 0};
+    bool two_colors = true;
     for (int y = 0; y < 8; y++)
     {
         for (int x = 0; x < 4; x++)
@@ -400,17 +615,41 @@ static chardata_t find_chardata(unsigned char *rgbraw,
                 max[i] = cstd_max(max[i], d);
                 color  = (color << 8) | d;
             }
+
+            int slot = color == colors[0] || colors[0] < 0 ? 0 : 1;
+            if (slot == 1 && colors[1] >= 0 && color != colors[1])
+            {
+                two_colors = false;
+            }
+            colors[slot] = color;
+            counts[slot]++;
         }
     }
 
-    int  count2            = 0;
-    long max_count_color_1 = 0;
-    long max_count_color_2 = 0;
+    // A cleanly two-tone block is drawn with exactly its two colors, the
+    // more frequent one as background.
+    bool second            = counts[1] > counts[0];
+    long max_count_color_1 = colors[second ? 1 : 0];
+    long max_count_color_2 = colors[second ? 0 : 1];
 
-    unsigned int bits       = 0;
-    bool         direct     = false;
+    unsigned int bits   = 0;
+    bool         direct = two_colors && colors[1] >= 0;
 #endif
 
+    // A flat block is a blank in its color: nothing to split or search.
+    if (min[0] == max[0] && min[1] == max[1] && min[2] == max[2])
+    {
+        chardata_t result;
+        memset(&result, 0, sizeof(result));
+        result.codepoint = BLANK_CODEPOINT;
+        for (int i = 0; i < 3; i++)
+        {
+            result.fg_color[i] = min[i];
+            result.bg_color[i] = min[i];
+        }
+        return result;
+    }
+
     if (direct)
     {
         for (int y = 0; y < 8; y++)
@@ -471,32 +710,59 @@ static chardata_t find_chardata(unsigned char *rgbraw,
         }
     }
 
-    // Find the best bitmap match by counting the bits that don't match,
-    // including the inverted bitmaps.
+    // A bitmap some glyph draws exactly needs no search. A restricted glyph
+    // set may leave out the glyph found, and then the search has the say.
     int          best_diff    = 8;
     unsigned int best_pattern = 0x0000ffff;
     int          codepoint    = 0x2584;
     bool         inverted     = false;
-    unsigned int end_marker   = 0;
-    for (int i = 0; BITMAPS[i + 1] != end_marker; i += 2)
+    int          exact        = find_exact_pattern(bits, &inverted);
+    if (exact >= 0 && glyph_allowed(glyphs, BITMAPS[exact + 1]))
     {
-        // Skip all end markers
-        if (BITMAPS[i + 1] < 32)
-        {
-            continue;
-        }
-        unsigned int pattern = BITMAPS[i];
-        for (int j = 0; j < 2; j++)
+        best_pattern = BITMAPS[exact];
+        codepoint    = BITMAPS[exact + 1];
+        best_diff    = 0;
+    }
+    else
+    {
+        // Find the best bitmap match by counting the bits that don't match,
+        // including the inverted bitmaps.
+        inverted                = false;
+        unsigned int end_marker = 0;
+        for (int i = 0; BITMAPS[i + 1] != end_marker; i += 2)
         {
-            int diff = cstd_bitcount(pattern ^ bits);
-            if (diff < best_diff)
+            // Skip all end markers
+            if (BITMAPS[i + 1] < 32 || !glyph_allowed(glyphs, BITMAPS[i + 1]))
+            {
+                continue;
+            }
+            unsigned int pattern = BITMAPS[i];
+            for (int j = 0; j < 2; j++)
             {
-                best_pattern = BITMAPS[i];  // pattern might be inverted.
-                codepoint    = BITMAPS[i + 1];
-                best_diff    = diff;
-                inverted     = best_pattern != pattern;
+                int diff = cstd_bitcount(pattern ^ bits);
+                if (diff < best_diff)
+                {
+                    best_pattern = BITMAPS[i];  // pattern might be inverted.
+                    codepoint    = BITMAPS[i + 1];
+                    best_diff    = diff;
+                    inverted     = best_pattern != pattern;
+                }
+                pattern = ~pattern;
             }
-            pattern = ~pattern;
+        }
+    }
+
+    if (glyphs == PRINT_GLYPHS_SEXTANT && best_diff > 0)
+    {
+        unsigned int pattern;
+        int          cp;
+        int          diff = match_sextant(bits, &pattern, &cp);
+        if (diff < best_diff)
+        {
+            best_pattern = pattern;
+            codepoint    = cp;
+            best_diff    = diff;
+            inverted     = false;
         }
     }
 
@@ -516,6 +782,7 @@ static chardata_t find_chardata(unsigned char *rgbraw,
             result.bg_color[i] = (max_count_color_1 >> shift) & 255;
             result.codepoint   = codepoint;
         }
+        result.pattern = best_pattern;
         return result;
     }
     return create_chardata(rgbraw, x0, y0, width, height, codepoint,
@@ -527,242 +794,1403 @@ static inline int clamp_byte(int value)
     return value < 0 ? 0 : (value > 255 ? 255 : value);
 }
 
-static void print_term_color(int is_bg, int r, int g, int b)
+// A cell color as it is sent to the terminal: 0xRRGGBB, or a palette index
+// tagged with COLOR_CODE_INDEXED. Equal codes produce identical escapes.
+#define COLOR_CODE_INDEXED 0x1000000
+#define COLOR_CODE_NONE    -1
+
+static int term_color_code(const int *rgb, int colors)
+{
+    int r = clamp_byte(rgb[0]);
+    int g = clamp_byte(rgb[1]);
+    int b = clamp_byte(rgb[2]);
+
+    if (colors == PRINT_COLORS_256)
+    {
+        return COLOR_CODE_INDEXED | rgb_to_ansi256(r, g, b);
+    }
+    return (r << 16) | (g << 8) | b;
+}
+
+static void print_term_color(outbuf_t *out, int is_bg, int code)
 {
-    r = clamp_byte(r);
-    g = clamp_byte(g);
-    b = clamp_byte(b);
+    if (code & COLOR_CODE_INDEXED)
+    {
+        outbuf_puts(out, is_bg ? "\x1b[48;5;" : "\x1b[38;5;");
+        outbuf_put_dec(out, code & 0xff, 1);
+        outbuf_puts(out, "m");
+        return;
+    }
 
-    printf("%s%d;%d;%dm", (is_bg ? "\x1b[48;2;" : "\x1b[38;2;"), r, g, b);
+    outbuf_puts(out, is_bg ? "\x1b[48;2;" : "\x1b[38;2;");
+    outbuf_put_dec(out, (code >> 16) & 0xff, 1);
+    outbuf_puts(out, ";");
+    outbuf_put_dec(out, (code >> 8) & 0xff, 1);
+    outbuf_puts(out, ";");
+    outbuf_put_dec(out, code & 0xff, 1);
+    outbuf_puts(out, "m");
 
     return;
 }
 
-static void print_codepoint(int codepoint)
+static void print_codepoint(outbuf_t *out, int codepoint)
 {
+    char utf8[4];
     if (codepoint < 128)
     {
-        printf("%c", (char)codepoint);
+        utf8[0] = (char)codepoint;
+        outbuf_write(out, utf8, 1);
     }
     else if (codepoint < 0x7ff)
     {
-        printf("%c%c", (char)(0xc0 | (codepoint >> 6)),
-               (char)(0x80 | (codepoint & 0x3f)));
+        utf8[0] = (char)(0xc0 | (codepoint >> 6));
+        utf8[1] = (char)(0x80 | (codepoint & 0x3f));
+        outbuf_write(out, utf8, 2);
     }
     else if (codepoint < 0xffff)
     {
-        printf("%c%c%c", (char)(0xe0 | (codepoint >> 12)),
-               (char)(0x80 | ((codepoint >> 6) & 0x3f)),
-               (char)(0x80 | (codepoint & 0x3f)));
+        utf8[0] = (char)(0xe0 | (codepoint >> 12));
+        utf8[1] = (char)(0x80 | ((codepoint >> 6) & 0x3f));
+        utf8[2] = (char)(0x80 | (codepoint & 0x3f));
+        outbuf_write(out, utf8, 3);
     }
     else if (codepoint < 0x10ffff)
     {
-        printf("%c%c%c%c", (char)(0xf0 | (codepoint >> 18)),
-               (char)(0x80 | ((codepoint >> 12) & 0x3f)),
-               (char)(0x80 | ((codepoint >> 06) & 0x3f)),
-               (char)(0x80 | (codepoint & 0x3f)));
+        utf8[0] = (char)(0xf0 | (codepoint >> 18));
+        utf8[1] = (char)(0x80 | ((codepoint >> 12) & 0x3f));
+        utf8[2] = (char)(0x80 | ((codepoint >> 06) & 0x3f));
+        utf8[3] = (char)(0x80 | (codepoint & 0x3f));
+        outbuf_write(out, utf8, 4);
     }
     else
     {
-        printf("codepoint ERROR\n");
+        outbuf_puts(out, "codepoint ERROR\n");
     }
 }
 
-static int trans_to_chardata(chardata_t    *cha,
-                             unsigned char *rgbraw,
-                             int            width,
-                             int            height)
+// Sum of absolute channel differences between the 4x8 block at x0,y0 and
+// the block as cell would draw it.
+static int cell_error(const unsigned char *rgbraw,
+                      int                  x0,
+                      int                  y0,
+                      int                  width,
+                      const chardata_t    *cell)
 {
-    chardata_t *cdata = cha;
-    for (int y = 0; y < height; y = y + 8)
+    int          err  = 0;
+    unsigned int mask = 0x80000000;
+    for (int y = 0; y < 8; y++)
     {
-        for (int x = 0; x < width; x = x + 4)
+        const unsigned char *px = rgbraw + ((size_t)width * (y0 + y) + x0) * 3;
+        for (int x = 0; x < 4; x++)
         {
-            *cdata = find_chardata(rgbraw, x, y, width, height);
-            cdata++;
+            const int *c = (cell->pattern & mask) ? cell->fg_color
+                                                  : cell->bg_color;
+            for (int i = 0; i < 3; i++)
+            {
+                err += abs(px[i] - c[i]);
+            }
+            px += 3;
+            mask = mask >> 1;
         }
     }
-    return 0;
+    return err;
 }
 
-struct trans_thread_args
+struct trans_job
 {
-    chardata_t    *ansi_char;
-    unsigned char *rgbraw;
-    int            width;
-    int            height;
+    chardata_t       *ansi_char;
+    unsigned char    *rgbraw;
+    int               width;
+    int               char_width;
+    int               char_height;
+    int               glyphs;
+    const chardata_t *prev;  // cells on screen, for hysteresis
+    int               margin;
+    uint64_t         *block_hash;  // per block cache, or NULL
+    chardata_t       *block_cell;
+    bool              block_valid;  // the cache holds the last frame
+    int               bands;
 };
 
-void *trans_to_chardata_thread(void *arg)
+static uint64_t block_hash(const unsigned char *rgbraw,
+                           int                  x0,
+                           int                  y0,
+                           int                  width)
 {
-    struct trans_thread_args *args = (struct trans_thread_args *)arg;
-    trans_to_chardata(args->ansi_char, args->rgbraw, args->width, args->height);
+    unsigned char block[8 * 4 * 3];
+    for (int y = 0; y < 8; y++)
+    {
+        memcpy(block + y * 4 * 3,
+               rgbraw + ((size_t)width * (y0 + y) + x0) * 3, 4 * 3);
+    }
+    return content_hash(block, sizeof(block), 0);
+}
 
-    return NULL;
+// Convert whole 4x8 blocks only; partial blocks at the right and bottom edge
+// are dropped. With prev set, a block keeps its previous cell unless the new
+// one is better by more than margin (mean per channel difference). Blocks
+// whose pixels hash the same as in the last frame reuse its result.
+static int trans_to_chardata(const struct trans_job *job,
+                             int                     row_begin,
+                             int                     row_end)
+{
+    unsigned char *rgbraw = job->rgbraw;
+    int            width  = job->width;
+    int            height = row_end * 8;
+
+    for (int y = row_begin * 8; y + 8 <= height; y = y + 8)
+    {
+        int i = (y / 8) * job->char_width;
+        for (int x = 0; x + 4 <= width; x = x + 4, i++)
+        {
+            chardata_t *cdata = job->ansi_char + i;
+            uint64_t    hash  = 0;
+            if (job->block_hash != NULL)
+            {
+                hash = block_hash(rgbraw, x, y, width);
+                if (job->block_valid && job->block_hash[i] == hash)
+                {
+                    *cdata = job->block_cell[i];
+                    continue;
+                }
+            }
+
+            *cdata = find_chardata(rgbraw, x, y, width, height, job->glyphs);
+            if (job->prev != NULL)
+            {
+                const chardata_t *prev     = job->prev + i;
+                int               keep_err = cell_error(rgbraw, x, y, width,
+                                                        prev);
+                int               new_err  = cell_error(rgbraw, x, y, width,
+                                                        cdata);
+                if (keep_err <= new_err + job->margin * 4 * 8 * 3)
+                {
+                    *cdata = *prev;
+                }
+            }
+
+            if (job->block_hash != NULL)
+            {
+                job->block_hash[i] = hash;
+                job->block_cell[i] = *cdata;
+            }
+        }
+    }
+    return 0;
 }
 
-static int print_rgb_rawdata(unsigned char *rgbraw, int width, int height)
+// One band of character rows, run on the worker pool.
+static void trans_to_chardata_band(void *arg, int band)
 {
-    int char_width  = (width / 4);
-    int char_height = (height / 8);
-    int char_length = char_width * char_height * sizeof(chardata_t);
+    struct trans_job *job = (struct trans_job *)arg;
 
-    //    printf("char_width %d, height %d, length %d\n", char_width,
-    //    char_height, char_length);
+    int row_begin = job->char_height * band / job->bands;
+    int row_end   = job->char_height * (band + 1) / job->bands;
 
-    chardata_t *chardata_scheme = (chardata_t *)malloc(char_length);
+    trans_to_chardata(job, row_begin, row_end);
+}
 
-// trans
-#ifndef MULTI_THREAD_TRANSFORM
-#define THREAD_NUM (1)
-    for (int thread_id = 0; thread_id < THREAD_NUM; thread_id++)
+// Whether a cell drawn as prev still shows cur closely enough.
+static bool cell_unchanged(const chardata_t *prev,
+                           const chardata_t *cur,
+                           int               tolerance)
+{
+    if (prev->codepoint != cur->codepoint)
     {
-        trans_to_chardata(
-            &chardata_scheme[char_width * char_height / THREAD_NUM * thread_id],
-            rgbraw + (width * height / THREAD_NUM * thread_id) * 3, width,
-            height / THREAD_NUM);
+        return false;
     }
-#else
-    int          THREAD_NUM = 1;
-    for (int t = 8; t >= 2; t--)
+    for (int i = 0; i < 3; i++)
     {
-        if (char_height % t == 0)
+        if (abs(prev->fg_color[i] - cur->fg_color[i]) > tolerance ||
+            abs(prev->bg_color[i] - cur->bg_color[i]) > tolerance)
         {
-            THREAD_NUM = t;
-            break;
+            return false;
         }
     }
+    return true;
+}
 
-    // printf("THREAD_NUM %d\n", THREAD_NUM);
+// Cell encoder. Colors are only sent when they differ from the ones in
+// effect, and runs of identical cells are collapsed with REP (repeat the last
+// glyph) or, for blank cells, ECH (erase with the background color) where the
+// terminal supports it.
 
-    pthread_t                thread_id[THREAD_NUM];
-    struct trans_thread_args args[THREAD_NUM];
-    int                      num;
-    for (num = 0; num < THREAD_NUM; num++)
-    {
-        args[num].ansi_char =
-            &chardata_scheme[char_width * char_height / THREAD_NUM * num];
-        args[num].rgbraw = rgbraw + (width * height / THREAD_NUM * num) * 3;
-        args[num].width  = width;
-        args[num].height = height / THREAD_NUM;
+struct draw_state
+{
+    outbuf_t *out;
+    int       colors;
+    int       caps;
+    int       bg;  // color codes in effect, COLOR_CODE_NONE after a reset
+    int       fg;
+    int       run_codepoint;  // pending run of identical cells
+    int       run_bg;
+    int       run_fg;  // COLOR_CODE_NONE for blank cells
+    int       run_len;
+    int       skipped;  // unchanged cells to move the cursor over
+};
 
-        pthread_create(&(thread_id[num]), NULL, trans_to_chardata_thread,
-                       (void *)&(args[num]));
-    }
+static void draw_begin(struct draw_state      *st,
+                       outbuf_t               *out,
+                       const print_img_opts_t *opts)
+{
+    st->out     = out;
+    st->colors  = opts->colors;
+    st->caps    = opts->term_caps;
+    st->bg      = COLOR_CODE_NONE;
+    st->fg      = COLOR_CODE_NONE;
+    st->run_len = 0;
+    st->skipped = 0;
+}
 
-    for (num = 0; num < THREAD_NUM; num++)
+static int utf8_length(int codepoint)
+{
+    if (codepoint < 0x80)
     {
-        pthread_join(thread_id[num], NULL);
+        return 1;
     }
-#endif
+    if (codepoint < 0x800)
+    {
+        return 2;
+    }
+    return codepoint < 0x10000 ? 3 : 4;
+}
 
-// draw
-#if 1
-    chardata_t *curr_chardata = chardata_scheme;
-    chardata_t *prev_chardata = chardata_scheme;
+static void draw_flush_run(struct draw_state *st)
+{
+    int n = st->run_len;
+    if (n == 0)
+    {
+        return;
+    }
+    st->run_len = 0;
 
-    for (int i = 0; i < (char_width * char_height);)
+    if (st->bg != st->run_bg)
     {
-        if ((i % char_width) == 0 ||
-            curr_chardata->bg_color != prev_chardata->bg_color)
-            print_term_color(1, curr_chardata->bg_color[0],
-                             curr_chardata->bg_color[1],
-                             curr_chardata->bg_color[2]);
-        if ((i % char_width) == 0 ||
-            curr_chardata->fg_color != prev_chardata->fg_color)
-            print_term_color(0, curr_chardata->fg_color[0],
-                             curr_chardata->fg_color[1],
-                             curr_chardata->fg_color[2]);
-        print_codepoint(curr_chardata->codepoint);
-        i++;
-        if ((i % char_width) == 0)
-            printf("\x1b[0m\n");
+        print_term_color(st->out, 1, st->run_bg);
+        st->bg = st->run_bg;
+    }
+    if (st->run_fg != COLOR_CODE_NONE && st->fg != st->run_fg)
+    {
+        print_term_color(st->out, 0, st->run_fg);
+        st->fg = st->run_fg;
+    }
 
-        prev_chardata = curr_chardata;
-        curr_chardata++;
+    // An escape costs 4 to 6 bytes; only use it when the glyphs cost more.
+    int glyph_bytes = utf8_length(st->run_codepoint);
+    if (st->run_codepoint == BLANK_CODEPOINT &&
+        (st->caps & PRINT_CAP_ECH) && n * glyph_bytes > 12)
+    {
+        // ECH leaves the cursor in place.
+        outbuf_printf(st->out, "\x1b[%dX\x1b[%dC", n, n);
+        return;
     }
-#endif
 
-    free(chardata_scheme);
-    return 0;
+    print_codepoint(st->out, st->run_codepoint);
+    n--;
+    if ((st->caps & PRINT_CAP_REP) && n * glyph_bytes > 6)
+    {
+        outbuf_printf(st->out, "\x1b[%db", n);
+        return;
+    }
+    while (n-- > 0)
+    {
+        print_codepoint(st->out, st->run_codepoint);
+    }
 }
 
-int print_img(unsigned char *img,
-              int            size,
-              unsigned int   opt_width,
-              unsigned int   opt_height,
-              int            compat)
+static void draw_cell(struct draw_state *st, const chardata_t *cell)
 {
-    int            rwidth, rheight, rchannels;
-    unsigned char *read_data =
-        stbi_load_from_memory(img, size, &rwidth, &rheight, &rchannels, 3);
+    int bg = term_color_code(cell->bg_color, st->colors);
+    int fg = cell->codepoint == BLANK_CODEPOINT
+                 ? COLOR_CODE_NONE
+                 : term_color_code(cell->fg_color, st->colors);
 
-    if (read_data == NULL)
+    if (st->run_len > 0 && st->run_codepoint == cell->codepoint &&
+        st->run_bg == bg && st->run_fg == fg)
     {
-        fprintf(stderr, "Error reading image data!\n\n");
-        return -1;
+        st->run_len++;
+        return;
     }
 
-    unsigned int desired_width, desired_height;
+    draw_flush_run(st);
+    if (st->skipped > 0)
+    {
+        outbuf_printf(st->out, "\x1b[%dC", st->skipped);
+        st->skipped = 0;
+    }
+    st->run_codepoint = cell->codepoint;
+    st->run_bg        = bg;
+    st->run_fg        = fg;
+    st->run_len       = 1;
+}
 
-    int        calc_w, calc_h;
-    static int last_calc_w = 0, last_calc_h = 0;
-    int        squashing_enabled = 1;
+static void draw_skip(struct draw_state *st)
+{
+    draw_flush_run(st);
+    st->skipped++;
+}
 
-    get_ideal_image_size(&calc_w, &calc_h, rwidth, rheight, squashing_enabled);
+static void draw_end_row(struct draw_state *st)
+{
+    draw_flush_run(st);
+    outbuf_puts(st->out, "\x1b[0m\n");
+    st->skipped = 0;
+    st->bg      = COLOR_CODE_NONE;
+    st->fg      = COLOR_CODE_NONE;
+}
 
-    if (last_calc_w != calc_w || calc_h != last_calc_h)
+// The cells a frame shows, when it was drawn with the same layout. Otherwise
+// the frame is set up for the new layout and NULL is returned.
+static chardata_t *frame_shown_cells(print_img_frame_t *frame,
+                                     int                char_width,
+                                     int                char_height)
+{
+    if (frame == NULL)
     {
-        last_calc_w = calc_w;
-        last_calc_h = calc_h;
-
-        printf("\033[H\033[J");  // clear screnn
+        return NULL;
     }
-
-    desired_width  = opt_width == 0 ? (unsigned int)calc_w * 4 : opt_width;
-    desired_height = opt_height == 0 ? (unsigned int)calc_h * 8 : opt_height;
-
-    if (compat == 1)
+    if (frame->cells != NULL && frame->char_width == char_width &&
+        frame->char_height == char_height)
     {
-        desired_width /= 4;
-        desired_height /= 8;
+        return frame->cells;
     }
 
-    // printf("desired_width %d, desired_height %d\n", desired_width,
-    // desired_height);
+    free(frame->cells);
+    frame->cells =
+        (chardata_t *)malloc(char_width * char_height * sizeof(chardata_t));
+    frame->char_width  = char_width;
+    frame->char_height = char_height;
+    return NULL;
+}
 
-    // Check for and do any needed image resizing...
-    unsigned char *data;
-    if (desired_width != (unsigned)rwidth ||
-        desired_height != (unsigned)rheight)
-    {
-        unsigned char *new_data = (unsigned char *)malloc(
-            3 * sizeof(unsigned char) * desired_width * desired_height);
-        int r = stbir_resize_uint8(read_data, rwidth, rheight, 0, new_data,
-                                   desired_width, desired_height, 0, 3);
+// Encode a grid of cells, skipping the ones shown still matches, and record
+// what ends up on screen in opts->frame.
+static void draw_chardata(outbuf_t               *out,
+                          const chardata_t       *cells,
+                          int                     char_width,
+                          int                     char_height,
+                          const chardata_t       *shown,
+                          const print_img_opts_t *opts)
+{
+    print_img_frame_t *frame = opts->frame;
 
-        if (r == 0)
+    struct draw_state draw;
+    draw_begin(&draw, out, opts);
+
+    const chardata_t *curr_chardata = cells;
+    for (int i = 0; i < (char_width * char_height);)
+    {
+        if (shown != NULL &&
+            cell_unchanged(shown + i, curr_chardata, opts->delta_tolerance))
         {
-            perror("Error resizing image:");
-            return -1;
+            draw_skip(&draw);
+        }
+        else
+        {
+            draw_cell(&draw, curr_chardata);
+            if (frame != NULL)
+            {
+                frame->cells[i] = *curr_chardata;
+            }
+        }
+        i++;
+        if ((i % char_width) == 0)
+        {
+            draw_end_row(&draw);
         }
-        stbi_image_free(read_data);
-        data = new_data;
-    }
-    else
-    {
-        data = read_data;
-    }
 
-    if (compat == 1)
-    {
-        print_rgb_rawdata_compat(data, desired_width, desired_height);
-    }
-    else
-    {
-        print_rgb_rawdata(data, desired_width, desired_height);
+        curr_chardata++;
     }
+}
 
-    stbi_image_free(data);
+static int print_rgb_rawdata(outbuf_t               *out,
+                             unsigned char          *rgbraw,
+                             int                     width,
+                             int                     height,
+                             const print_img_opts_t *opts)
+{
+    int char_width  = (width / 4);
+    int char_height = (height / 8);
+    int char_length = char_width * char_height * sizeof(chardata_t);
+
+    //    printf("char_width %d, height %d, length %d\n", char_width,
+    //    char_height, char_length);
+
+    chardata_t *chardata_scheme = (chardata_t *)malloc(char_length);
+
+    // Cells of the previous frame, when it has the same layout.
+    print_img_frame_t *frame = opts->frame;
+    chardata_t        *shown = frame_shown_cells(frame, char_width, char_height);
+
+// trans
+    struct trans_job job;
+    job.ansi_char   = chardata_scheme;
+    job.rgbraw      = rgbraw;
+    job.width       = width;
+    job.char_width  = char_width;
+    job.char_height = char_height;
+    job.glyphs      = opts->glyphs;
+    job.prev        = opts->hysteresis > 0 ? shown : NULL;
+    job.margin      = opts->hysteresis;
+    job.block_hash  = NULL;
+    job.block_cell  = NULL;
+    job.block_valid = false;
+    if (frame != NULL)
+    {
+        if (frame->block_hash == NULL || frame->block_width != char_width ||
+            frame->block_height != char_height)
+        {
+            free(frame->block_hash);
+            free(frame->block_cell);
+            frame->block_hash =
+                (uint64_t *)malloc(char_width * char_height * sizeof(uint64_t));
+            frame->block_cell   = (chardata_t *)malloc(char_length);
+            frame->block_width  = char_width;
+            frame->block_height = char_height;
+        }
+        else
+        {
+            job.block_valid = frame->block_glyphs == opts->glyphs &&
+                              frame->block_margin == job.margin;
+        }
+        frame->block_glyphs = opts->glyphs;
+        frame->block_margin = job.margin;
+        job.block_hash      = frame->block_hash;
+        job.block_cell      = frame->block_cell;
+    }
+#ifndef MULTI_THREAD_TRANSFORM
+    job.bands = 1;
+#else
+    job.bands = cstd_min(pool_threads(), cstd_max(char_height, 1));
+#endif
+    pool_run(job.bands, trans_to_chardata_band, &job);
+
+// draw
+    draw_chardata(out, chardata_scheme, char_width, char_height, shown, opts);
+
+    free(chardata_scheme);
+    return 0;
+}
+
+// Dot modes render one pixel per sub-cell of a 2x4 grid. Pixels brighter
+// than the cell's mean are drawn in the foreground color, and the resulting
+// 8-bit mask picks the glyph directly, so no pattern search is needed.
+
+// Braille: every subset of dots has its own code point, U+2800 plus these
+// bits.
+static const unsigned char BRAILLE_DOTS[4][2] = {
+    {0x01, 0x08},
+    {0x02, 0x10},
+    {0x04, 0x20},
+    {0x40, 0x80},
+};
+
+// Octants: sub-cells are numbered row by row, octant 1 in bit 0.
+static const unsigned char OCTANT_DOTS[4][2] = {
+    {0x01, 0x02},
+    {0x04, 0x08},
+    {0x10, 0x20},
+    {0x40, 0x80},
+};
+
+// Code point for each octant mask. U+1CD00..U+1CDE5 cover the masks in
+// order, except the 26 shapes that already exist as block elements: halves,
+// quadrants, quarter and three quarter blocks, and the octant corners from
+// U+1CEA0.
+static const unsigned int OCTANT_CODEPOINTS[256] = {
+    0x000a0, 0x1cea8, 0x1ceab, 0x1fb82, 0x1cd00, 0x02598, 0x1cd01, 0x1cd02,
+    0x1cd03, 0x1cd04, 0x0259d, 0x1cd05, 0x1cd06, 0x1cd07, 0x1cd08, 0x02580,
+    0x1cd09, 0x1cd0a, 0x1cd0b, 0x1cd0c, 0x1fbe6, 0x1cd0d, 0x1cd0e, 0x1cd0f,
+    0x1cd10, 0x1cd11, 0x1cd12, 0x1cd13, 0x1cd14, 0x1cd15, 0x1cd16, 0x1cd17,
+    0x1cd18, 0x1cd19, 0x1cd1a, 0x1cd1b, 0x1cd1c, 0x1cd1d, 0x1cd1e, 0x1cd1f,
+    0x1fbe7, 0x1cd20, 0x1cd21, 0x1cd22, 0x1cd23, 0x1cd24, 0x1cd25, 0x1cd26,
+    0x1cd27, 0x1cd28, 0x1cd29, 0x1cd2a, 0x1cd2b, 0x1cd2c, 0x1cd2d, 0x1cd2e,
+    0x1cd2f, 0x1cd30, 0x1cd31, 0x1cd32, 0x1cd33, 0x1cd34, 0x1cd35, 0x1fb85,
+    0x1cea3, 0x1cd36, 0x1cd37, 0x1cd38, 0x1cd39, 0x1cd3a, 0x1cd3b, 0x1cd3c,
+    0x1cd3d, 0x1cd3e, 0x1cd3f, 0x1cd40, 0x1cd41, 0x1cd42, 0x1cd43, 0x1cd44,
+    0x02596, 0x1cd45, 0x1cd46, 0x1cd47, 0x1cd48, 0x0258c, 0x1cd49, 0x1cd4a,
+    0x1cd4b, 0x1cd4c, 0x0259e, 0x1cd4d, 0x1cd4e, 0x1cd4f, 0x1cd50, 0x0259b,
+    0x1cd51, 0x1cd52, 0x1cd53, 0x1cd54, 0x1cd55, 0x1cd56, 0x1cd57, 0x1cd58,
+    0x1cd59, 0x1cd5a, 0x1cd5b, 0x1cd5c, 0x1cd5d, 0x1cd5e, 0x1cd5f, 0x1cd60,
+    0x1cd61, 0x1cd62, 0x1cd63, 0x1cd64, 0x1cd65, 0x1cd66, 0x1cd67, 0x1cd68,
+    0x1cd69, 0x1cd6a, 0x1cd6b, 0x1cd6c, 0x1cd6d, 0x1cd6e, 0x1cd6f, 0x1cd70,
+    0x1cea0, 0x1cd71, 0x1cd72, 0x1cd73, 0x1cd74, 0x1cd75, 0x1cd76, 0x1cd77,
+    0x1cd78, 0x1cd79, 0x1cd7a, 0x1cd7b, 0x1cd7c, 0x1cd7d, 0x1cd7e, 0x1cd7f,
+    0x1cd80, 0x1cd81, 0x1cd82, 0x1cd83, 0x1cd84, 0x1cd85, 0x1cd86, 0x1cd87,
+    0x1cd88, 0x1cd89, 0x1cd8a, 0x1cd8b, 0x1cd8c, 0x1cd8d, 0x1cd8e, 0x1cd8f,
+    0x02597, 0x1cd90, 0x1cd91, 0x1cd92, 0x1cd93, 0x0259a, 0x1cd94, 0x1cd95,
+    0x1cd96, 0x1cd97, 0x02590, 0x1cd98, 0x1cd99, 0x1cd9a, 0x1cd9b, 0x0259c,
+    0x1cd9c, 0x1cd9d, 0x1cd9e, 0x1cd9f, 0x1cda0, 0x1cda1, 0x1cda2, 0x1cda3,
+    0x1cda4, 0x1cda5, 0x1cda6, 0x1cda7, 0x1cda8, 0x1cda9, 0x1cdaa, 0x1cdab,
+    0x02582, 0x1cdac, 0x1cdad, 0x1cdae, 0x1cdaf, 0x1cdb0, 0x1cdb1, 0x1cdb2,
+    0x1cdb3, 0x1cdb4, 0x1cdb5, 0x1cdb6, 0x1cdb7, 0x1cdb8, 0x1cdb9, 0x1cdba,
+    0x1cdbb, 0x1cdbc, 0x1cdbd, 0x1cdbe, 0x1cdbf, 0x1cdc0, 0x1cdc1, 0x1cdc2,
+    0x1cdc3, 0x1cdc4, 0x1cdc5, 0x1cdc6, 0x1cdc7, 0x1cdc8, 0x1cdc9, 0x1cdca,
+    0x1cdcb, 0x1cdcc, 0x1cdcd, 0x1cdce, 0x1cdcf, 0x1cdd0, 0x1cdd1, 0x1cdd2,
+    0x1cdd3, 0x1cdd4, 0x1cdd5, 0x1cdd6, 0x1cdd7, 0x1cdd8, 0x1cdd9, 0x1cdda,
+    0x02584, 0x1cddb, 0x1cddc, 0x1cddd, 0x1cdde, 0x02599, 0x1cddf, 0x1cde0,
+    0x1cde1, 0x1cde2, 0x0259f, 0x1cde3, 0x02586, 0x1cde4, 0x1cde5, 0x02588,
+};
+
+// Fill in the colors of a 2x4 cell and return its dot mask, made of the
+// dots table bits of the pixels drawn in the foreground color. A flat cell
+// has no dots and becomes a blank in the average color.
+static int dot_cell(const unsigned char *rgbraw,
+                    int                  x0,
+                    int                  y0,
+                    int                  width,
+                    const unsigned char  dots[4][2],
+                    chardata_t          *cell)
+{
+    int lum[4][2];
+    int total = 0;
+    int sum[3] = {0};
+    for (int y = 0; y < 4; y++)
+    {
+        const unsigned char *px = rgbraw + ((size_t)width * (y0 + y) + x0) * 3;
+        for (int x = 0; x < 2; x++, px += 3)
+        {
+            lum[y][x] = px[0] * 2 + px[1] * 5 + px[2];
+            total += lum[y][x];
+            for (int i = 0; i < 3; i++)
+            {
+                sum[i] += px[i];
+            }
+        }
+    }
+
+    // Compare against the mean without dividing: lum * 8 > total.
+    int bits   = 0;
+    int fg[3]  = {0};
+    int fg_cnt = 0;
+    for (int y = 0; y < 4; y++)
+    {
+        const unsigned char *px = rgbraw + ((size_t)width * (y0 + y) + x0) * 3;
+        for (int x = 0; x < 2; x++, px += 3)
+        {
+            if (lum[y][x] * 8 > total)
+            {
+                bits |= dots[y][x];
+                fg_cnt++;
+                for (int i = 0; i < 3; i++)
+                {
+                    fg[i] += px[i];
+                }
+            }
+        }
+    }
+
+    memset(cell, 0, sizeof(*cell));
+    if (fg_cnt == 0)
+    {
+        cell->codepoint = BLANK_CODEPOINT;
+        for (int i = 0; i < 3; i++)
+        {
+            cell->bg_color[i] = sum[i] / 8;
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        cell->fg_color[i] = fg[i] / fg_cnt;
+        cell->bg_color[i] = (sum[i] - fg[i]) / (8 - fg_cnt);
+    }
+    return bits;
+}
+
+static int print_rgb_dots(outbuf_t               *out,
+                          unsigned char          *rgbraw,
+                          int                     width,
+                          int                     height,
+                          const print_img_opts_t *opts)
+{
+    int  char_width  = width / 2;
+    int  char_height = height / 4;
+    bool octant      = opts->mode == PRINT_MODE_OCTANT;
+
+    const unsigned char(*dots)[2] = octant ? OCTANT_DOTS : BRAILLE_DOTS;
+
+    chardata_t *cells =
+        (chardata_t *)malloc(char_width * char_height * sizeof(chardata_t));
+    chardata_t *shown =
+        frame_shown_cells(opts->frame, char_width, char_height);
+
+    chardata_t *cell = cells;
+    for (int y = 0; y < char_height; y++)
+    {
+        for (int x = 0; x < char_width; x++, cell++)
+        {
+            int bits = dot_cell(rgbraw, x * 2, y * 4, width, dots, cell);
+            if (bits != 0)
+            {
+                cell->codepoint =
+                    octant ? OCTANT_CODEPOINTS[bits] : 0x2800 + bits;
+            }
+        }
+    }
+
+    draw_chardata(out, cells, char_width, char_height, shown, opts);
+
+    free(cells);
+    return 0;
+}
+
+// ASCII: one character per pixel, picked by luma from a density ramp.
+static const char ASCII_RAMP[] = " .:-=+*#%@";
+
+static int print_ascii(outbuf_t            *out,
+                       const unsigned char *pixels,
+                       int                  width,
+                       int                  height,
+                       int                  channels)
+{
+    char lut[256];
+    int  levels = sizeof(ASCII_RAMP) - 1;
+    for (int i = 0; i < 256; i++)
+    {
+        lut[i] = ASCII_RAMP[i * levels / 256];
+    }
+
+    outbuf_reserve(out, (size_t)(width + 1) * height);
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char *px   = pixels + (size_t)width * channels * y;
+        char                *line = out->data + out->len;
+        for (int x = 0; x < width; x++, px += channels)
+        {
+            int luma = channels == 1
+                           ? px[0]
+                           : (px[0] * 77 + px[1] * 150 + px[2] * 29) >> 8;
+            line[x] = lut[luma];
+        }
+        line[width] = '\n';
+        out->len += width + 1;
+    }
+    return 0;
+}
+
+print_img_frame_t *print_img_frame_create(void)
+{
+    return (print_img_frame_t *)calloc(1, sizeof(print_img_frame_t));
+}
+
+void print_img_frame_reset(print_img_frame_t *frame)
+{
+    free(frame->cells);
+    frame->cells       = NULL;
+    frame->char_width  = 0;
+    frame->char_height = 0;
+}
+
+void print_img_frame_free(print_img_frame_t *frame)
+{
+    if (frame != NULL)
+    {
+        free(frame->cells);
+        free(frame->block_hash);
+        free(frame->block_cell);
+        free(frame);
+    }
+}
+
+void print_img_frame_grid(const print_img_frame_t *frame, int *cols, int *rows)
+{
+    bool drawn = frame->cells != NULL;
+    *cols      = drawn ? frame->char_width : 0;
+    *rows      = drawn ? frame->char_height : 0;
+}
+
+int print_img_frame_cell(const print_img_frame_t *frame,
+                         int                      col,
+                         int                      row,
+                         unsigned int            *codepoint,
+                         int                     *fg,
+                         int                     *bg)
+{
+    if (frame->cells == NULL || col < 0 || row < 0 ||
+        col >= frame->char_width || row >= frame->char_height)
+    {
+        return -1;
+    }
+
+    const chardata_t *cell = frame->cells + row * frame->char_width + col;
+    *codepoint             = cell->codepoint;
+    *fg = (cell->fg_color[0] << 16) | (cell->fg_color[1] << 8) |
+          cell->fg_color[2];
+    *bg = (cell->bg_color[0] << 16) | (cell->bg_color[1] << 8) |
+          cell->bg_color[2];
+    return 0;
+}
+
+// kitty graphics protocol
+// https://sw.kovidgoyal.net/kitty/graphics-protocol/
+#define KITTY_CHUNK_SIZE 4096
+
+static const char BASE64_TABLE[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static size_t base64_encode(const unsigned char *src, size_t len, char *dst)
+{
+    char  *out = dst;
+    size_t i;
+    for (i = 0; i + 2 < len; i += 3)
+    {
+        unsigned int v = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+        *out++         = BASE64_TABLE[(v >> 18) & 0x3f];
+        *out++         = BASE64_TABLE[(v >> 12) & 0x3f];
+        *out++         = BASE64_TABLE[(v >> 6) & 0x3f];
+        *out++         = BASE64_TABLE[v & 0x3f];
+    }
+    if (i < len)
+    {
+        unsigned int v = src[i] << 16;
+        if (i + 1 < len)
+        {
+            v |= src[i + 1] << 8;
+        }
+        *out++ = BASE64_TABLE[(v >> 18) & 0x3f];
+        *out++ = BASE64_TABLE[(v >> 12) & 0x3f];
+        *out++ = (i + 1 < len) ? BASE64_TABLE[(v >> 6) & 0x3f] : '=';
+        *out++ = '=';
+    }
+    *out = '\0';
+    return out - dst;
+}
+
+#define KITTY_PROBE_ID 31  // image id of the shared memory probe
+
+static bool kitty_shm_ok = false;
+
+// Ask the terminal on /dev/tty to read a one pixel shm object (a=q, which
+// draws nothing), then for its device attributes, which every terminal
+// answers. Only a terminal that read the object replies OK with the probe's
+// image id before that; one on another host or in another container, or
+// behind tmux or mosh, does not, and then the object is unlinked here.
+static void probe_kitty_shm(void)
+{
+    if (!isatty(STDOUT_FILENO))
+    {
+        return;
+    }
+    int tty = open("/dev/tty", O_RDWR | O_NOCTTY);
+    if (tty < 0)
+    {
+        return;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "/pimg-%d-probe", (int)getpid());
+    const unsigned char pixel[3] = {0, 0, 0};
+    int  fd    = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    bool ready = fd >= 0 && write(fd, pixel, 3) == 3;
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    struct termios saved, raw;
+    if (ready && tcgetattr(tty, &saved) == 0)
+    {
+        raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        tcsetattr(tty, TCSANOW, &raw);
+
+        char encoded_name[sizeof(name) * 4 / 3 + 4];
+        base64_encode((const unsigned char *)name, strlen(name), encoded_name);
+        char query[160];
+        int  len = snprintf(query, sizeof(query),
+                            "\x1b_Gi=%d,a=q,t=s,f=24,s=1,v=1,S=3;%s\x1b\\"
+                            "\x1b[c",
+                            KITTY_PROBE_ID, encoded_name);
+
+        char   reply[256];
+        size_t got = 0;
+        if (write(tty, query, len) == len)
+        {
+            // Read up to the device attributes reply, ESC [ ? ... c.
+            struct pollfd pfd = {tty, POLLIN, 0};
+            while (got < sizeof(reply) - 1 && poll(&pfd, 1, 500) > 0)
+            {
+                ssize_t n = read(tty, reply + got, sizeof(reply) - 1 - got);
+                if (n <= 0)
+                {
+                    break;
+                }
+                got += n;
+                reply[got]     = '\0';
+                const char *da = strstr(reply, "\x1b[?");
+                if (da != NULL && strchr(da, 'c') != NULL)
+                {
+                    break;
+                }
+            }
+        }
+        tcsetattr(tty, TCSANOW, &saved);
+        reply[got] = '\0';
+
+        char ok[32];
+        snprintf(ok, sizeof(ok), "\x1b_Gi=%d;OK", KITTY_PROBE_ID);
+        kitty_shm_ok = strstr(reply, ok) != NULL;
+    }
+    if (fd >= 0)
+    {
+        shm_unlink(name);
+    }
+    close(tty);
+}
+
+// Shared memory only works when the terminal runs on this host and reads
+// it, which the probe above finds out once. Live modes transmit directly:
+// the writer may replace a frame before the terminal sees it, and nothing
+// would unlink the object it names; a recording could not replay such names
+// either.
+static bool kitty_shm_usable(void)
+{
+    if (writer_running() || getenv("SSH_CONNECTION") != NULL ||
+        getenv("SSH_TTY") != NULL)
+    {
+        return false;
+    }
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, probe_kitty_shm);
+    return kitty_shm_ok;
+}
+
+// Hand the pixels to the terminal through a POSIX shm object; the terminal
+// unlinks it once it has read the data. Only the control escape goes through
+// the pty.
+static int print_rgb_kitty_shm(outbuf_t      *out,
+                               unsigned char *rgbraw,
+                               unsigned int   width,
+                               unsigned int   height,
+                               int            cols,
+                               int            rows)
+{
+    static unsigned int seq = 0;
+
+    char   name[64];
+    size_t length = (size_t)width * height * 3;
+    snprintf(name, sizeof(name), "/pimg-%d-%u", (int)getpid(), seq++);
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (ftruncate(fd, length) != 0)
+    {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    void *shm = mmap(NULL, length, PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return -1;
+    }
+    memcpy(shm, rgbraw, length);
+    munmap(shm, length);
+
+    char encoded_name[sizeof(name) * 4 / 3 + 4];
+    base64_encode((const unsigned char *)name, strlen(name), encoded_name);
+
+    outbuf_printf(out, "\x1b_Ga=T,q=2,f=24,t=s,s=%u,v=%u,S=%zu,c=%d,r=%d;%s\x1b\\",
+                  width, height, length, cols, rows, encoded_name);
+    outbuf_puts(out, "\n");
+    return 0;
+}
+
+// Fallback: transmit the pixels as base64 in chunks through the pty.
+static int print_rgb_kitty_direct(outbuf_t      *out,
+                                  unsigned char *rgbraw,
+                                  unsigned int   width,
+                                  unsigned int   height,
+                                  int            cols,
+                                  int            rows)
+{
+    size_t length  = (size_t)width * height * 3;
+    char  *encoded = (char *)malloc((length + 2) / 3 * 4 + 1);
+    size_t total   = base64_encode(rgbraw, length, encoded);
+
+    outbuf_reserve(out, total + (total / KITTY_CHUNK_SIZE + 1) * 16 + 64);
+    for (size_t off = 0; off < total; off += KITTY_CHUNK_SIZE)
+    {
+        size_t chunk = cstd_min(total - off, (size_t)KITTY_CHUNK_SIZE);
+        int    more  = off + chunk < total;
+        if (off == 0)
+        {
+            outbuf_printf(out, "\x1b_Ga=T,q=2,f=24,t=d,s=%u,v=%u,c=%d,r=%d,m=%d;",
+                          width, height, cols, rows, more);
+        }
+        else
+        {
+            outbuf_printf(out, "\x1b_Gm=%d;", more);
+        }
+        outbuf_write(out, encoded + off, chunk);
+        outbuf_puts(out, "\x1b\\");
+    }
+    outbuf_puts(out, "\n");
+
+    free(encoded);
+    return 0;
+}
+
+static int print_rgb_kitty(outbuf_t      *out,
+                           unsigned char *rgbraw,
+                           unsigned int   width,
+                           unsigned int   height,
+                           int            cols,
+                           int            rows)
+{
+    if (kitty_shm_usable() &&
+        print_rgb_kitty_shm(out, rgbraw, width, height, cols, rows) == 0)
+    {
+        return 0;
+    }
+    return print_rgb_kitty_direct(out, rgbraw, width, height, cols, rows);
+}
+
+// Output size for an image of the given size at the current terminal size.
+// With may_clear set, clears the screen (through out, or stdout when NULL)
+// when the fitted size changed since the last such call.
+static void get_render_geometry(int                     image_width,
+                                int                     image_height,
+                                const print_img_opts_t *opts,
+                                bool                    may_clear,
+                                outbuf_t               *out,
+                                struct render_geometry *geo)
+{
+    int        calc_w, calc_h;
+    static int last_calc_w = 0, last_calc_h = 0;
+    int        squashing_enabled = 1;
+
+    get_ideal_image_size(&calc_w, &calc_h, image_width, image_height,
+                         squashing_enabled, opts);
+
+    // Shrink the image to fewer cells (of the same size) when asked to save
+    // bandwidth.
+    if (opts->cell_scale > 0 && opts->cell_scale < 100)
+    {
+        calc_w = cstd_max(calc_w * opts->cell_scale / 100, 1);
+        calc_h = cstd_max(calc_h * opts->cell_scale / 100, 1);
+    }
+
+    // ASCII output is meant for logs and stays free of escapes.
+    if (opts->mode == PRINT_MODE_ASCII)
+    {
+        may_clear = false;
+    }
+
+    if (may_clear && (last_calc_w != calc_w || calc_h != last_calc_h ||
+                      opts->always_clear))
+    {
+        last_calc_w = calc_w;
+        last_calc_h = calc_h;
+
+        if (out != NULL)
+        {
+            outbuf_puts(out, "\033[H\033[J");
+        }
+        else
+        {
+            printf("\033[H\033[J");  // clear screnn
+        }
+    }
+
+    // Pixels per cell: 4x8 for the glyph matcher, the real cell size when
+    // the terminal draws the pixels itself.
+    geo->cell_w = 4;
+    geo->cell_h = 8;
+    if (opts->mode == PRINT_MODE_KITTY)
+    {
+        get_term_cell_size(opts, &geo->cell_w, &geo->cell_h);
+    }
+    else if (opts->mode == PRINT_MODE_BRAILLE ||
+             opts->mode == PRINT_MODE_OCTANT)
+    {
+        geo->cell_w = 2;
+        geo->cell_h = 4;
+    }
+    else if (opts->mode == PRINT_MODE_ASCII)
+    {
+        geo->cell_w = 1;
+        geo->cell_h = 1;
+    }
+
+    geo->width = opts->width == 0 ? (unsigned int)(calc_w * geo->cell_w)
+                                  : opts->width;
+    geo->height = opts->height == 0 ? (unsigned int)(calc_h * geo->cell_h)
+                                    : opts->height;
+
+    if (opts->mode == PRINT_MODE_COMPAT)
+    {
+        geo->width /= 4;
+        geo->height /= 8;
+    }
+
+    // printf("desired_width %d, desired_height %d\n", geo->width,
+    // geo->height);
+}
+
+// Resize a decoded image to the output size and encode it into out. Only
+// ASCII output accepts luma (channels 1) as well as RGB. A trailing alpha
+// channel is composited onto opts->background while resizing.
+static int render_rgb(outbuf_t                     *out,
+                      unsigned char                *read_data,
+                      int                           rwidth,
+                      int                           rheight,
+                      int                           channels,
+                      const struct render_geometry *geo,
+                      const print_img_opts_t       *opts)
+{
+    unsigned int desired_width  = geo->width;
+    unsigned int desired_height = geo->height;
+
+    // Check for and do any needed image resizing...
+    unsigned char *data  = read_data;
+    bool           alpha = channels % 2 == 0;
+    if (desired_width != (unsigned)rwidth ||
+        desired_height != (unsigned)rheight || alpha)
+    {
+        int resize_channels = channels;
+        if (alpha)
+        {
+            channels--;
+        }
+        data = (unsigned char *)malloc(channels * sizeof(unsigned char) *
+                                       desired_width * desired_height);
+        int r = resize_image(read_data, rwidth, rheight, data, desired_width,
+                             desired_height, resize_channels, opts->resample,
+                             opts->background);
+
+        if (r == 0)
+        {
+            perror("Error resizing image:");
+            free(data);
+            return -1;
+        }
+    }
+
+    if (opts->mode == PRINT_MODE_COMPAT)
+    {
+        print_rgb_rawdata_compat(out, data, desired_width, desired_height,
+                                 opts->colors);
+    }
+    else if (opts->mode == PRINT_MODE_KITTY)
+    {
+        print_rgb_kitty(out, data, desired_width, desired_height,
+                        (desired_width + geo->cell_w - 1) / geo->cell_w,
+                        (desired_height + geo->cell_h - 1) / geo->cell_h);
+    }
+    else if (opts->mode == PRINT_MODE_BRAILLE ||
+             opts->mode == PRINT_MODE_OCTANT)
+    {
+        print_rgb_dots(out, data, desired_width, desired_height, opts);
+    }
+    else if (opts->mode == PRINT_MODE_ASCII)
+    {
+        print_ascii(out, data, desired_width, desired_height, channels);
+    }
+    else
+    {
+        print_rgb_rawdata(out, data, desired_width, desired_height, opts);
+    }
+
+    if (data != read_data)
+    {
+        free(data);
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+// Channels to decode an image with file_channels into: the mode's own, plus
+// alpha when the file has it.
+static int decode_channels(const print_img_opts_t *opts, int file_channels)
+{
+    int channels = print_img_channels(opts);
+    if (file_channels == 2 || file_channels == 4)
+    {
+        channels++;
+    }
+    return channels;
+}
+
+// Repack width x height pixels from src_channels into dst_channels, luma to
+// RGB or back (with stb_image's luma weights), keeping alpha.
+static unsigned char *convert_channels(const unsigned char *src,
+                                       int                  width,
+                                       int                  height,
+                                       int                  src_channels,
+                                       int                  dst_channels)
+{
+    unsigned char *dst =
+        (unsigned char *)malloc((size_t)width * height * dst_channels);
+    if (dst == NULL)
+    {
+        return NULL;
+    }
+
+    bool           src_rgb = src_channels >= 3;
+    bool           dst_rgb = dst_channels >= 3;
+    unsigned char *p       = dst;
+    for (size_t i = 0; i < (size_t)width * height; i++)
+    {
+        if (src_rgb && !dst_rgb)
+        {
+            p[0] = (src[0] * 77 + src[1] * 150 + src[2] * 29) >> 8;
+        }
+        else if (!src_rgb && dst_rgb)
+        {
+            p[0] = p[1] = p[2] = src[0];
+        }
+        else
+        {
+            memcpy(p, src, dst_rgb ? 3 : 1);
+        }
+        if (dst_channels % 2 == 0)
+        {
+            p[dst_channels - 1] =
+                src_channels % 2 == 0 ? src[src_channels - 1] : 255;
+        }
+        src += src_channels;
+        p += dst_channels;
+    }
+    return dst;
+}
+
+int print_img(unsigned char *img,
+              int            size,
+              unsigned int   opt_width,
+              unsigned int   opt_height,
+              int            mode)
+{
+    print_img_opts_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.width    = opt_width;
+    opts.height   = opt_height;
+    opts.mode     = mode;
+    opts.resample = PRINT_RESAMPLE_AUTO;
+
+    return print_img_ex(img, size, &opts);
+}
+
+int print_img_ex(unsigned char *img, int size, const print_img_opts_t *opts)
+{
+    int rwidth, rheight, rchannels;
+    if (!stbi_info_from_memory(img, size, &rwidth, &rheight, &rchannels))
+    {
+        fprintf(stderr, "Error reading image data!\n\n");
+        return -1;
+    }
+
+    struct render_geometry geo;
+    get_render_geometry(rwidth, rheight, opts, true, NULL, &geo);
+    int channels = decode_channels(opts, rchannels);
+
+    // Everything that shapes the output besides the input bytes. Kitty frames
+    // may point at a one-shot shm object and are never cached.
+    struct
+    {
+        unsigned int width;
+        unsigned int height;
+        int          mode;
+        int          resample;
+        int          colors;
+        int          glyphs;
+        int          term_caps;
+        int          background;
+        float        exposure;
+    } render_key;
+    memset(&render_key, 0, sizeof(render_key));
+    render_key.width      = geo.width;
+    render_key.height     = geo.height;
+    render_key.mode       = opts->mode;
+    render_key.resample   = opts->resample;
+    render_key.colors     = opts->colors;
+    render_key.glyphs     = opts->glyphs;
+    render_key.term_caps  = opts->term_caps;
+    render_key.background = opts->background;
+    render_key.exposure   = opts->exposure;
+
+    bool use_cache = opts->cache_dir != NULL && opts->mode != PRINT_MODE_KITTY;
+    uint64_t content = 0, params = 0;
+
+    outbuf_t out;
+    outbuf_init(&out);
+
+    if (use_cache)
+    {
+        content = content_hash(img, size, 0);
+        params  = content_hash(&render_key, sizeof(render_key), 0);
+        if (render_cache_load(opts->cache_dir, content, params, &out) == 0)
+        {
+            fwrite(out.data, 1, out.len, stdout);
+            outbuf_free(&out);
+            return 0;
+        }
+    }
+
+    // Show a quick 1/8 scale decode first and draw the full one over it.
+    // ASCII output has no escapes to move back over the preview with.
+    if (opts->progressive && opts->mode != PRINT_MODE_ASCII)
+    {
+        int            coarse_w, coarse_h;
+        unsigned char *coarse =
+            decode_image_coarse(img, size, &coarse_w, &coarse_h, channels,
+                                geo.width, geo.height);
+        if (coarse != NULL && render_rgb(&out, coarse, coarse_w, coarse_h,
+                                         channels, &geo, opts) == 0)
+        {
+            fwrite(out.data, 1, out.len, stdout);
+            fflush(stdout);
+            printf("\033[H");
+        }
+        stbi_image_free(coarse);
+        out.len = 0;
+    }
+
+    // Let the decoder drop resolution we would throw away anyway.
+    unsigned char *read_data =
+        decode_image(img, size, &rwidth, &rheight, channels, geo.width,
+                     geo.height, opts->exposure);
+    if (read_data == NULL)
+    {
+        fprintf(stderr, "Error reading image data!\n\n");
+        outbuf_free(&out);
+        return -1;
+    }
+
+    int ret =
+        render_rgb(&out, read_data, rwidth, rheight, channels, &geo, opts);
+    if (ret == 0)
+    {
+        fwrite(out.data, 1, out.len, stdout);
+        if (use_cache)
+        {
+            render_cache_store(opts->cache_dir, content, params, &out);
+        }
+    }
+
+    stbi_image_free(read_data);
+    outbuf_free(&out);
+    return ret;
+}
+
+int print_img_decode(unsigned char          *img,
+                     int                     size,
+                     const print_img_opts_t *opts,
+                     print_img_image_t      *image)
+{
+    memset(image, 0, sizeof(*image));
+    if (!stbi_info_from_memory(img, size, &image->src_width,
+                               &image->src_height, &image->channels))
+    {
+        fprintf(stderr, "Error reading image data!\n\n");
+        return -1;
+    }
+
+    // Keep enough pixels for the largest output the image can be asked for:
+    // the requested size, or the biggest terminal get_term_size() allows.
+    // ASCII needs a single pixel per cell.
+    int cell_w = opts->mode == PRINT_MODE_ASCII ? 1 : 4;
+    int cell_h = opts->mode == PRINT_MODE_ASCII ? 1 : 8;
+    int min_w = opts->width != 0 ? (int)opts->width : TERM_MAX_COLS * cell_w;
+    int min_h = opts->height != 0 ? (int)opts->height : TERM_MAX_ROWS * cell_h;
+    if (opts->mode == PRINT_MODE_KITTY)
+    {
+        min_w = min_h = 0;
+    }
+
+    image->channels = decode_channels(opts, image->channels);
+    image->pixels   = decode_image(img, size, &image->width, &image->height,
+                                   image->channels, min_w, min_h,
+                                   opts->exposure);
+    if (image->pixels == NULL)
+    {
+        fprintf(stderr, "Error reading image data!\n\n");
+        return -1;
+    }
+    return 0;
+}
+
+int print_img_render(const print_img_image_t *image,
+                     const print_img_opts_t  *opts)
+{
+    outbuf_t out;
+    outbuf_init(&out);
+
+    int ret = print_img_render_buf(image, opts, &out);
+    if (ret == 0)
+    {
+        fwrite(out.data, 1, out.len, stdout);
+    }
+
+    outbuf_free(&out);
+    return ret;
+}
+
+int print_img_render_buf(const print_img_image_t *image,
+                         const print_img_opts_t  *opts,
+                         outbuf_t                *out)
+{
+    if (image->channels < 1 || image->channels > 4)
+    {
+        fprintf(stderr, "Unsupported pixel format!\n\n");
+        return -1;
+    }
+
+    // An image decoded for another mode (luma for ASCII, RGB for the rest)
+    // is converted instead of being read with the wrong pixel size.
+    int            channels = decode_channels(opts, image->channels);
+    unsigned char *pixels   = image->pixels;
+    if (channels != image->channels)
+    {
+        pixels = convert_channels(image->pixels, image->width, image->height,
+                                  image->channels, channels);
+        if (pixels == NULL)
+        {
+            perror("Error converting image:");
+            return -1;
+        }
+    }
+
+    struct render_geometry geo;
+    get_render_geometry(image->src_width, image->src_height, opts, true, out,
+                        &geo);
+
+    int ret = render_rgb(out, pixels, image->width, image->height, channels,
+                         &geo, opts);
+    if (pixels != image->pixels)
+    {
+        free(pixels);
+    }
+    return ret;
+}
+
+int print_img_channels(const print_img_opts_t *opts)
+{
+    return opts->mode == PRINT_MODE_ASCII ? 1 : 3;
+}
+
+void print_img_output_size(int                     image_width,
+                           int                     image_height,
+                           const print_img_opts_t *opts,
+                           unsigned int           *width,
+                           unsigned int           *height)
+{
+    struct render_geometry geo;
+    get_render_geometry(image_width, image_height, opts, false, NULL, &geo);
+    *width  = geo.width;
+    *height = geo.height;
+}
+
+void print_img_image_free(print_img_image_t *image)
+{
+    stbi_image_free(image->pixels);
+    memset(image, 0, sizeof(*image));
+}
@@ -1,9 +1,134 @@
 #ifndef _PRINT_IMG_H
 #define _PRINT_IMG_H
 
+#include "outbuf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Output backends, selected through the mode argument of print_img.
+#define PRINT_MODE_BLOCK   0  // 4x8 block/line glyphs with fg/bg colors
+#define PRINT_MODE_COMPAT  1  // one colored space per pixel
+#define PRINT_MODE_KITTY   2  // kitty graphics protocol
+#define PRINT_MODE_BRAILLE 3  // 2x4 braille dots with fg/bg colors
+#define PRINT_MODE_OCTANT  4  // 2x4 octant blocks (U+1CD00) with fg/bg colors
+#define PRINT_MODE_ASCII   5  // plain ASCII density ramp from luma, no escapes
+
+// Resampler used to fit the image to the output size.
+#define PRINT_RESAMPLE_AUTO  0  // area average for large reductions, else stbir
+#define PRINT_RESAMPLE_STBIR 1  // stb_image_resize default filters
+#define PRINT_RESAMPLE_AREA  2  // integer area average (shrinking only)
+
+// Color escapes used for cell and pixel colors.
+#define PRINT_COLORS_TRUE 0  // 24-bit SGR colors
+#define PRINT_COLORS_256  1  // nearest xterm 256-color palette entry
+
+// Glyphs the block mode may pick for a 4x8 cell.
+#define PRINT_GLYPHS_FULL    0  // blocks, quadrants, lines and misc shapes
+#define PRINT_GLYPHS_BLOCKS  1  // eighth blocks and quadrants only
+#define PRINT_GLYPHS_HALF    2  // lower half block only
+#define PRINT_GLYPHS_SEXTANT 3  // full set plus 3x2 sextants (U+1FB00)
+
+// Optional terminal features the block encoder may use (bit mask).
+#define PRINT_CAP_REP 0x1  // CSI n b: repeat the preceding glyph
+#define PRINT_CAP_ECH 0x2  // CSI n X: erase cells with the background color
+
+// Previous frame of a live render, see print_img_frame_create().
+typedef struct print_img_frame print_img_frame_t;
+
+// Passed by pointer across the shared library ABI: a layout change needs a
+// new soname (see Makefile).
+typedef struct
+{
+    unsigned int       width;        // output size in pixels, 0 to fit
+    unsigned int       height;
+    int                mode;         // PRINT_MODE_*
+    int                resample;     // PRINT_RESAMPLE_*
+    int                progressive;  // coarse preview of large JPEGs first
+    const char        *cache_dir;    // render cache directory, NULL disables
+    int                colors;       // PRINT_COLORS_*
+    int                glyphs;       // PRINT_GLYPHS_*
+    int                cell_scale;   // % of the fitted size, 0 means 100
+    int                delta_tolerance;  // per channel, for frame deltas
+    print_img_frame_t *frame;            // skip unchanged cells, or NULL
+    int                term_caps;        // PRINT_CAP_*
+    int                hysteresis;       // margin for replacing a shown cell
+    int                background;       // 0xRRGGBB under transparent pixels
+    float              exposure;         // stops applied to HDR input
+    int                term_cols;        // terminal to fit, 0 to ask stdout
+    int                term_rows;
+    int                term_xpixel;      // its size in pixels (kitty), or 0
+    int                term_ypixel;
+    int                always_clear;     // clear on every render, not on resize
+} print_img_opts_t;
+
 int print_img(unsigned char *img,
               int            size,
               unsigned int   opt_width,
               unsigned int   opt_height,
-              int            compat);
+              int            mode);
+
+// Decode once, render many times (e.g. on every terminal resize).
+typedef struct
+{
+    unsigned char *pixels;  // packed RGB (luma for ASCII), maybe reduced
+    int            width;
+    int            height;
+    int            channels;
+    int            src_width;  // size of the encoded image
+    int            src_height;
+} print_img_image_t;
+
+int print_img_ex(unsigned char *img, int size, const print_img_opts_t *opts);
+
+int  print_img_decode(unsigned char          *img,
+                      int                     size,
+                      const print_img_opts_t *opts,
+                      print_img_image_t      *image);
+int  print_img_render(const print_img_image_t *image,
+                      const print_img_opts_t  *opts);
+void print_img_image_free(print_img_image_t *image);
+
+// print_img_render() into a buffer instead of stdout. An image decoded with
+// opts for another mode is converted to the channels this mode renders from.
+int print_img_render_buf(const print_img_image_t *image,
+                         const print_img_opts_t  *opts,
+                         outbuf_t                *out);
+
+// Live rendering: with opts->frame set, block mode frames only redraw cells
+// whose glyph changed or whose colors moved by more than opts->delta_tolerance
+// since they were last drawn. With opts->hysteresis > 0 a cell also keeps its
+// glyph and colors unless the new choice is closer to the pixels by more than
+// that mean difference per channel, which keeps noisy video from flickering.
+// Each frame must reach the screen, in order; reset the frame when one may
+// have been lost or the screen was cleared.
+print_img_frame_t *print_img_frame_create(void);
+void               print_img_frame_reset(print_img_frame_t *frame);
+void               print_img_frame_free(print_img_frame_t *frame);
+
+// Grid a block mode frame last drew: its size in cells, and each cell's code
+// point and 0xRRGGBB colors. print_img_frame_cell() returns -1 outside it.
+void print_img_frame_grid(const print_img_frame_t *frame, int *cols, int *rows);
+int  print_img_frame_cell(const print_img_frame_t *frame,
+                          int                      col,
+                          int                      row,
+                          unsigned int            *codepoint,
+                          int                     *fg,
+                          int                     *bg);
+
+// Channels per pixel the mode renders from: 1 (luma) for ASCII, else 3.
+int print_img_channels(const print_img_opts_t *opts);
+
+// Size in pixels (characters in compat mode) that print_img_render() would
+// resize an image with src_width x src_height to.
+void print_img_output_size(int                     image_width,
+                           int                     image_height,
+                           const print_img_opts_t *opts,
+                           unsigned int           *width,
+                           unsigned int           *height);
+
+#ifdef __cplusplus
+}
+#endif
 #endif
@@ -0,0 +1,125 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pyramid.h"
+
+// Stop halving once a level is this small; terminals never need less.
+#define PYRAMID_MIN_SIZE 32
+#define PYRAMID_MAX_LEVELS 16
+
+struct pyramid
+{
+    pyramid_level_t levels[PYRAMID_MAX_LEVELS];
+    int             count;  // levels that will exist when done
+    int             ready;  // written by the builder, read atomically
+    int             cancel;
+    pthread_t       thread;
+};
+
+// 2x2 box average of src into dst. An odd last row or column is dropped.
+static bool half_level(const pyramid_level_t *src,
+                       unsigned char         *dst,
+                       int                    dst_w,
+                       int                    dst_h,
+                       const int             *cancel)
+{
+    size_t src_stride = (size_t)src->width * 3;
+    for (int y = 0; y < dst_h; y++)
+    {
+        if (__atomic_load_n(cancel, __ATOMIC_RELAXED))
+        {
+            return false;
+        }
+
+        const unsigned char *r0  = src->pixels + src_stride * (2 * y);
+        const unsigned char *r1  = r0 + src_stride;
+        unsigned char       *out = dst + (size_t)dst_w * 3 * y;
+        for (int x = 0; x < dst_w; x++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                int sum = r0[6 * x + c] + r0[6 * x + 3 + c] + r1[6 * x + c] +
+                          r1[6 * x + 3 + c];
+                *out++ = (unsigned char)((sum + 2) >> 2);
+            }
+        }
+    }
+    return true;
+}
+
+static void *build_levels(void *arg)
+{
+    pyramid_t *pyr = (pyramid_t *)arg;
+
+    for (int i = 1; i < pyr->count; i++)
+    {
+        pyramid_level_t *lv = &pyr->levels[i];
+        unsigned char   *px = (unsigned char *)malloc((size_t)lv->width *
+                                                      lv->height * 3);
+        if (px == NULL ||
+            !half_level(&pyr->levels[i - 1], px, lv->width, lv->height,
+                        &pyr->cancel))
+        {
+            free(px);
+            break;
+        }
+        lv->pixels = px;
+        __atomic_store_n(&pyr->ready, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+pyramid_t *pyramid_create(const unsigned char *base, int width, int height)
+{
+    pyramid_t *pyr = (pyramid_t *)calloc(1, sizeof(pyramid_t));
+    pyr->levels[0].pixels = base;
+    pyr->levels[0].width  = width;
+    pyr->levels[0].height = height;
+    pyr->count            = 1;
+    pyr->ready            = 1;
+
+    while (pyr->count < PYRAMID_MAX_LEVELS)
+    {
+        const pyramid_level_t *prev = &pyr->levels[pyr->count - 1];
+        if (prev->width / 2 < PYRAMID_MIN_SIZE ||
+            prev->height / 2 < PYRAMID_MIN_SIZE)
+        {
+            break;
+        }
+        pyr->levels[pyr->count].width  = prev->width / 2;
+        pyr->levels[pyr->count].height = prev->height / 2;
+        pyr->count++;
+    }
+
+    if (pyr->count > 1 &&
+        pthread_create(&pyr->thread, NULL, build_levels, pyr) != 0)
+    {
+        pyr->count = 1;
+    }
+    return pyr;
+}
+
+void pyramid_destroy(pyramid_t *pyr)
+{
+    if (pyr->count > 1)
+    {
+        __atomic_store_n(&pyr->cancel, 1, __ATOMIC_RELAXED);
+        pthread_join(pyr->thread, NULL);
+    }
+    for (int i = 1; i < pyr->count; i++)
+    {
+        free((void *)pyr->levels[i].pixels);
+    }
+    free(pyr);
+}
+
+int pyramid_ready(pyramid_t *pyr)
+{
+    return __atomic_load_n(&pyr->ready, __ATOMIC_ACQUIRE);
+}
+
+const pyramid_level_t *pyramid_level(pyramid_t *pyr, int i)
+{
+    return &pyr->levels[i];
+}
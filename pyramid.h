@@ -0,0 +1,26 @@
+#ifndef _PYRAMID_H
+#define _PYRAMID_H
+
+// Mipmap pyramid of a packed RGB image. Level 0 is the image itself, every
+// further level halves both sides. Levels are built on a background thread
+// and become usable one after the other.
+typedef struct
+{
+    const unsigned char *pixels;
+    int                  width;
+    int                  height;
+} pyramid_level_t;
+
+typedef struct pyramid pyramid_t;
+
+// base is borrowed and must outlive the pyramid.
+pyramid_t *pyramid_create(const unsigned char *base, int width, int height);
+void       pyramid_destroy(pyramid_t *pyr);
+
+// Number of levels that are ready, at least 1.
+int pyramid_ready(pyramid_t *pyr);
+
+// Level i, i < pyramid_ready().
+const pyramid_level_t *pyramid_level(pyramid_t *pyr, int i);
+
+#endif
@@ -0,0 +1,158 @@
+#include <string.h>
+
+#include "print_img.h"
+#include "rate_ctl.h"
+#include "writer.h"
+
+// Frames in a row before the level moves; stepping up is deliberately slower
+// so the controller does not oscillate around the limit.
+#define RATE_STEP_DOWN_FRAMES 3
+#define RATE_STEP_UP_FRAMES   15
+#define RATE_HEADROOM         0.5  // step up below this share of the budget
+#define RATE_SMOOTHING        0.3  // weight of the newest sample
+
+static const struct
+{
+    int colors;
+    int glyphs;
+    int cell_scale;
+    int tolerance;
+} RATE_LEVELS[] = {
+    {PRINT_COLORS_TRUE, PRINT_GLYPHS_FULL, 100, 0},
+    {PRINT_COLORS_TRUE, PRINT_GLYPHS_FULL, 100, 6},
+    {PRINT_COLORS_TRUE, PRINT_GLYPHS_BLOCKS, 100, 12},
+    {PRINT_COLORS_256, PRINT_GLYPHS_BLOCKS, 100, 12},
+    {PRINT_COLORS_256, PRINT_GLYPHS_BLOCKS, 75, 16},
+    {PRINT_COLORS_256, PRINT_GLYPHS_HALF, 50, 24},
+};
+
+#define RATE_LEVEL_COUNT (int)(sizeof(RATE_LEVELS) / sizeof(RATE_LEVELS[0]))
+
+void rate_ctl_init(rate_ctl_t *rc, double fps, const print_img_opts_t *opts)
+{
+    memset(rc, 0, sizeof(*rc));
+    rc->budget     = fps > 0 ? 1.0 / fps : 0;
+    rc->colors     = opts->colors;
+    rc->glyphs     = opts->glyphs;
+    rc->cell_scale = opts->cell_scale;
+    rc->tolerance  = opts->delta_tolerance;
+    writer_get_stats(&rc->last);
+}
+
+// Glyph sets from the fewest shapes to the most.
+static int glyph_rank(int glyphs)
+{
+    switch (glyphs)
+    {
+        case PRINT_GLYPHS_HALF:
+            return 0;
+        case PRINT_GLYPHS_BLOCKS:
+            return 1;
+        case PRINT_GLYPHS_SEXTANT:
+            return 3;
+        default:
+            return 2;
+    }
+}
+
+bool rate_ctl_apply(const rate_ctl_t *rc, print_img_opts_t *opts)
+{
+    int l          = rc->level;
+    int colors     = rc->colors;
+    int glyphs     = rc->glyphs;
+    int cell_scale = rc->cell_scale;
+    int tolerance  = rc->tolerance;
+
+    if (RATE_LEVELS[l].colors == PRINT_COLORS_256)
+    {
+        colors = PRINT_COLORS_256;
+    }
+    // PRINT_GLYPHS_FULL on the ladder leaves the glyph set alone, sextants
+    // included.
+    if (RATE_LEVELS[l].glyphs != PRINT_GLYPHS_FULL &&
+        glyph_rank(RATE_LEVELS[l].glyphs) < glyph_rank(glyphs))
+    {
+        glyphs = RATE_LEVELS[l].glyphs;
+    }
+    if (RATE_LEVELS[l].cell_scale <
+        (cell_scale > 0 && cell_scale < 100 ? cell_scale : 100))
+    {
+        cell_scale = RATE_LEVELS[l].cell_scale;
+    }
+    if (RATE_LEVELS[l].tolerance > tolerance)
+    {
+        tolerance = RATE_LEVELS[l].tolerance;
+    }
+
+    bool changed = opts->colors != colors || opts->glyphs != glyphs ||
+                   opts->cell_scale != cell_scale ||
+                   opts->delta_tolerance != tolerance;
+
+    opts->colors          = colors;
+    opts->glyphs          = glyphs;
+    opts->cell_scale      = cell_scale;
+    opts->delta_tolerance = tolerance;
+    return changed;
+}
+
+static double smooth(double old_value, double sample)
+{
+    return old_value == 0
+               ? sample
+               : old_value + RATE_SMOOTHING * (sample - old_value);
+}
+
+void rate_ctl_update(rate_ctl_t *rc, double render_seconds, size_t bytes)
+{
+    if (rc->budget <= 0)
+    {
+        return;
+    }
+
+    // Throughput of the writes finished since the last frame. Writes that
+    // return at once (room in the pty buffer) say little, skip them.
+    writer_stats_t now;
+    writer_get_stats(&now);
+    size_t dbytes   = now.bytes - rc->last.bytes;
+    double dseconds = now.seconds - rc->last.seconds;
+    bool   dropped  = now.dropped != rc->last.dropped;
+    rc->last        = now;
+    if (dbytes > 0 && dseconds > 1e-3)
+    {
+        rc->throughput = smooth(rc->throughput, dbytes / dseconds);
+    }
+
+    double cost = render_seconds;
+    if (rc->throughput > 0)
+    {
+        cost += bytes / rc->throughput;
+    }
+    rc->cost = smooth(rc->cost, cost);
+
+    if (dropped || rc->cost > rc->budget)
+    {
+        rc->under = 0;
+        if (++rc->over >= RATE_STEP_DOWN_FRAMES &&
+            rc->level + 1 < RATE_LEVEL_COUNT)
+        {
+            rc->level++;
+            rc->over = 0;
+            rc->cost = 0;
+        }
+    }
+    else if (rc->cost < rc->budget * RATE_HEADROOM)
+    {
+        rc->over = 0;
+        if (++rc->under >= RATE_STEP_UP_FRAMES && rc->level > 0)
+        {
+            rc->level--;
+            rc->under = 0;
+            rc->cost  = 0;
+        }
+    }
+    else
+    {
+        rc->over  = 0;
+        rc->under = 0;
+    }
+}
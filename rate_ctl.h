@@ -0,0 +1,40 @@
+#ifndef _RATE_CTL_H
+#define _RATE_CTL_H
+
+#include <stddef.h>
+
+#include "print_img.h"
+#include "writer.h"
+
+// Keeps live rendering at a target frame rate by trading quality for bytes.
+// Every frame is charged its render time plus the time the writer thread
+// needs to push its bytes at the measured throughput; sustained overruns step
+// down a quality ladder (delta tolerance, glyph set, 256 colors, fewer cells),
+// sustained headroom steps back up.
+typedef struct
+{
+    double         budget;      // seconds per frame
+    int            level;       // index into the quality ladder
+    int            over;        // consecutive frames over budget
+    int            under;       // consecutive frames well within budget
+    double         throughput;  // bytes per second, smoothed, 0 if unknown
+    double         cost;        // seconds per frame, smoothed
+    writer_stats_t last;
+
+    // The caller's knobs: no level draws better than these.
+    int colors;
+    int glyphs;
+    int cell_scale;
+    int tolerance;
+} rate_ctl_t;
+
+void rate_ctl_init(rate_ctl_t *rc, double fps, const print_img_opts_t *opts);
+
+// Set the quality knobs of opts for the current level, degraded from the
+// caller's and never better; level 0 is the caller's own. Returns true when
+// anything changed, in which case a delta base is no longer valid.
+bool rate_ctl_apply(const rate_ctl_t *rc, print_img_opts_t *opts);
+
+// Account for a frame that took render_seconds to encode into bytes.
+void rate_ctl_update(rate_ctl_t *rc, double render_seconds, size_t bytes);
+#endif
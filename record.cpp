@@ -0,0 +1,263 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "record.h"
+
+// File layout: a record_header, then for every frame a record_frame followed
+// by its bytes. Fields are little-endian as written on x86 and arm hosts;
+// headers are copied out, so frames need no alignment.
+#define RECORD_MAGIC   "PIMGREC"
+#define RECORD_VERSION 1
+
+#define RECORD_FRAME_CLEAR 1  // clear the screen before the frame
+
+#define RECORD_CLEAR "\033[H\033[J"
+
+struct record_header
+{
+    char     magic[8];
+    uint32_t version;
+    uint16_t cols;  // terminal size while recording
+    uint16_t rows;
+};
+
+struct record_frame
+{
+    uint64_t time_ns;  // since the recording started
+    uint32_t length;
+    uint32_t flags;  // RECORD_FRAME_*
+};
+
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct
+{
+    FILE           *fp;
+    struct timespec start;
+} recorder;
+
+static volatile sig_atomic_t replay_quit = 0;
+
+static void on_quit(int sig)
+{
+    (void)sig;
+    replay_quit = 1;
+}
+
+int print_img_record_start(const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    struct record_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+    hdr.version = RECORD_VERSION;
+
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0)
+    {
+        hdr.cols = ws.ws_col;
+        hdr.rows = ws.ws_row;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+
+    pthread_mutex_lock(&record_lock);
+    if (recorder.fp != NULL)
+    {
+        fclose(recorder.fp);
+    }
+    recorder.fp = fp;
+    clock_gettime(CLOCK_MONOTONIC, &recorder.start);
+    pthread_mutex_unlock(&record_lock);
+    return 0;
+}
+
+void print_img_record_stop(void)
+{
+    pthread_mutex_lock(&record_lock);
+    if (recorder.fp != NULL)
+    {
+        fclose(recorder.fp);
+        recorder.fp = NULL;
+    }
+    pthread_mutex_unlock(&record_lock);
+}
+
+void print_img_record_frame(const char *data, size_t len, int clear)
+{
+    pthread_mutex_lock(&record_lock);
+    if (recorder.fp != NULL)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        struct record_frame frame;
+        frame.time_ns = (uint64_t)(now.tv_sec - recorder.start.tv_sec) *
+                            1000000000 +
+                        now.tv_nsec - recorder.start.tv_nsec;
+        frame.length = (uint32_t)len;
+        frame.flags  = clear ? RECORD_FRAME_CLEAR : 0;
+        fwrite(&frame, sizeof(frame), 1, recorder.fp);
+        fwrite(data, 1, len, recorder.fp);
+    }
+    pthread_mutex_unlock(&record_lock);
+}
+
+// writev() until every byte of iov is out.
+static int writev_full(int fd, struct iovec *iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0)
+        {
+            if (errno == EINTR && !replay_quit)
+            {
+                continue;
+            }
+            return -1;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+int print_img_replay(const char *path, int fd)
+{
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(file, &st) != 0 || (size_t)st.st_size < sizeof(record_header))
+    {
+        fprintf(stderr, "%s is not a recording\n", path);
+        close(file);
+        return -1;
+    }
+
+    // Frames are written straight from the mapping.
+    size_t size = (size_t)st.st_size;
+    const char *map =
+        (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    madvise((void *)map, size, MADV_SEQUENTIAL);
+
+    struct record_header hdr;
+    memcpy(&hdr, map, sizeof(hdr));
+    if (memcmp(hdr.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0 ||
+        hdr.version != RECORD_VERSION)
+    {
+        fprintf(stderr, "%s is not a recording\n", path);
+        munmap((void *)map, size);
+        return -1;
+    }
+
+    struct winsize ws;
+    if (ioctl(fd, TIOCGWINSZ, &ws) == 0 &&
+        (ws.ws_col < hdr.cols || ws.ws_row < hdr.rows))
+    {
+        fprintf(stderr, "Recorded on a %ux%u terminal, this one is %ux%u\n",
+                hdr.cols, hdr.rows, ws.ws_col, ws.ws_row);
+    }
+
+    // No SA_RESTART: a signal has to cut the sleep short.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_quit;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    replay_quit = 0;
+
+    const char hide[] = "\033[?25l";
+    const char show[] = "\033[?25h";
+    write(fd, hide, sizeof(hide) - 1);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    size_t pos = sizeof(hdr);
+    while (!replay_quit && size - pos >= sizeof(record_frame))
+    {
+        struct record_frame frame;
+        memcpy(&frame, map + pos, sizeof(frame));
+        pos += sizeof(frame);
+        if (frame.length > size - pos)
+        {
+            break;  // cut short while recording
+        }
+
+        // Sleep until the frame is due, on the clock the replay started on.
+        struct timespec due;
+        uint64_t        ns = (uint64_t)start.tv_nsec + frame.time_ns;
+        due.tv_sec         = start.tv_sec + (time_t)(ns / 1000000000);
+        due.tv_nsec        = (long)(ns % 1000000000);
+        while (!replay_quit &&
+               clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) ==
+                   EINTR)
+        {
+        }
+        if (replay_quit)
+        {
+            break;
+        }
+
+        struct iovec iov[2];
+        int          count = 0;
+        if (frame.flags & RECORD_FRAME_CLEAR)
+        {
+            iov[count].iov_base = (void *)RECORD_CLEAR;
+            iov[count].iov_len  = sizeof(RECORD_CLEAR) - 1;
+            count++;
+        }
+        iov[count].iov_base = (void *)(map + pos);
+        iov[count].iov_len  = frame.length;
+        count++;
+        if (writev_full(fd, iov, count) != 0)
+        {
+            break;
+        }
+        pos += frame.length;
+    }
+
+    write(fd, show, sizeof(show) - 1);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    munmap((void *)map, size);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Recordings hold the escape stream of every frame a live mode (resident,
+// viewer, video) put on screen, with the time it was written. Frames drawn
+// as deltas stay deltas, so a recording is as compact as the output itself
+// and replaying it needs no decoding or encoding at all.
+
+// Record every frame written from now on into path. Returns 0 or -1.
+int print_img_record_start(const char *path);
+
+// Finish the recording.
+void print_img_record_stop(void);
+
+// Append a frame to the recording, if there is one. With clear set the
+// screen was cleared before the frame.
+void print_img_record_frame(const char *data, size_t len, int clear);
+
+// Write the frames of the recording at path to fd at their recorded pace.
+// Returns 0, or -1 when the file is not a recording. SIGINT/SIGTERM stop the
+// replay early.
+int print_img_replay(const char *path, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,190 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "render_cache.h"
+
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t content_hash(const void *data, size_t len, uint64_t seed)
+{
+    const unsigned char *p   = (const unsigned char *)data;
+    const unsigned char *end = p + len;
+    uint64_t             h;
+
+    if (len >= 32)
+    {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        do
+        {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    }
+    else
+    {
+        h = seed + PRIME64_5;
+    }
+
+    h += (uint64_t)len;
+
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++)
+    {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static void render_cache_path(char       *path,
+                              size_t      size,
+                              const char *dir,
+                              uint64_t    content,
+                              uint64_t    params)
+{
+    snprintf(path, size, "%s/%016llx-%016llx.pimg", dir,
+             (unsigned long long)content, (unsigned long long)params);
+}
+
+int render_cache_load(const char *dir,
+                      uint64_t    content,
+                      uint64_t    params,
+                      outbuf_t   *out)
+{
+    char path[PATH_MAX];
+    render_cache_path(path, sizeof(path), dir, content, params);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    size_t start = out->len;
+    size_t want  = (size_t)st.st_size;
+    outbuf_reserve(out, want);
+    while (out->len - start < want)
+    {
+        ssize_t n = read(fd, out->data + out->len, want - (out->len - start));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            out->len = start;
+            close(fd);
+            return -1;
+        }
+        out->len += (size_t)n;
+    }
+
+    close(fd);
+    return 0;
+}
+
+// Written under a temporary name and renamed into place, so that concurrent
+// readers never see a partial entry.
+void render_cache_store(const char     *dir,
+                        uint64_t        content,
+                        uint64_t        params,
+                        const outbuf_t *out)
+{
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX + 32];
+    render_cache_path(path, sizeof(path), dir, content, params);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+
+    mkdir(dir, 0755);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    int ret = outbuf_flush_fd(out, fd);
+    close(fd);
+    if (ret != 0 || rename(tmp_path, path) != 0)
+    {
+        unlink(tmp_path);
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef _RENDER_CACHE_H
+#define _RENDER_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "outbuf.h"
+
+// Fast 64-bit hash (XXH64) of a byte buffer.
+uint64_t content_hash(const void *data, size_t len, uint64_t seed);
+
+// Finished escape streams are stored in dir as one file per
+// (input content, render parameters) pair. Load returns 0 on a hit and
+// appends the stream to out.
+int  render_cache_load(const char *dir,
+                       uint64_t    content,
+                       uint64_t    params,
+                       outbuf_t   *out);
+void render_cache_store(const char     *dir,
+                        uint64_t        content,
+                        uint64_t        params,
+                        const outbuf_t *out);
+#endif
@@ -0,0 +1,527 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stb/stb_image.h"
+
+#include "img_decode.h"
+#include "img_resize.h"
+#include "print_img.h"
+#include "pyramid.h"
+#include "rate_ctl.h"
+#include "resident.h"
+#include "writer.h"
+
+// Quiet time after the last SIGWINCH before redrawing. Dragging a window edge
+// sends a burst of signals; only the size it settles at gets rendered.
+#define RESIZE_DEBOUNCE_MS 50
+
+static int signal_pipe[2] = {-1, -1};
+
+// Signal handlers only write the signal number to a pipe, the main loop does
+// the rest.
+static void on_signal(int sig)
+{
+    int           saved = errno;
+    unsigned char b     = (unsigned char)sig;
+    write(signal_pipe[1], &b, 1);
+    errno = saved;
+}
+
+static int install_handlers(void)
+{
+    if (pipe(signal_pipe) != 0)
+    {
+        return -1;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(signal_pipe[i], F_SETFL,
+              fcntl(signal_pipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(signal_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sa.sa_flags   = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    return 0;
+}
+
+static void remove_handlers(void)
+{
+    signal(SIGWINCH, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    close(signal_pipe[0]);
+    close(signal_pipe[1]);
+    signal_pipe[0] = signal_pipe[1] = -1;
+}
+
+// Read pending signals. Returns 1 for a resize, -1 for quit, 0 for nothing.
+static int drain_signals(void)
+{
+    unsigned char buf[64];
+    int           ret = 0;
+    ssize_t       n;
+    while ((n = read(signal_pipe[0], buf, sizeof(buf))) > 0)
+    {
+        for (ssize_t i = 0; i < n; i++)
+        {
+            if (buf[i] == SIGWINCH && ret == 0)
+            {
+                ret = 1;
+            }
+            else if (buf[i] != SIGWINCH)
+            {
+                ret = -1;
+            }
+        }
+    }
+    return ret;
+}
+
+// One interactive screen: draw() paints it, key() reacts to input and returns
+// true when the screen needs painting again.
+struct resident_view
+{
+    void (*draw)(void *ctx, bool full);
+    bool (*key)(void *ctx, const char *keys, int len);
+    void *ctx;
+};
+
+// Run view until 'q' or SIGINT/SIGTERM. A full redraw follows every resize
+// once the window has settled.
+static int run_resident(struct resident_view *view)
+{
+    if (install_handlers() != 0)
+    {
+        perror("pipe");
+        return -1;
+    }
+
+    // Read single keys without echo so 'q' works without Enter.
+    struct termios saved_tio;
+    bool           raw_tty = isatty(STDIN_FILENO) &&
+                   tcgetattr(STDIN_FILENO, &saved_tio) == 0;
+    if (raw_tty)
+    {
+        struct termios tio = saved_tio;
+        tio.c_lflag &= ~(ICANON | ECHO);
+        tio.c_cc[VMIN]  = 1;
+        tio.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &tio);
+    }
+
+    printf("\033[?25l");  // hide cursor
+    fflush(stdout);
+
+    // Frames go out on the writer thread; a slow terminal drops frames
+    // instead of delaying the reaction to the next key.
+    writer_start(STDOUT_FILENO);
+    view->draw(view->ctx, true);
+
+    bool running    = true;
+    bool pending    = false;  // a resize arrived and is waiting to settle
+    bool stdin_open = true;
+    while (running)
+    {
+        struct pollfd fds[2];
+        fds[0].fd     = signal_pipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd     = stdin_open ? STDIN_FILENO : -1;
+        fds[1].events = POLLIN;
+
+        int n = poll(fds, 2, pending ? RESIZE_DEBOUNCE_MS : -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        if (n == 0)
+        {
+            // The window has been still for a while: draw it once.
+            pending = false;
+            view->draw(view->ctx, true);
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int sig = drain_signals();
+            if (sig < 0)
+            {
+                running = false;
+            }
+            else if (sig > 0)
+            {
+                pending = true;
+            }
+        }
+
+        if (fds[1].revents & (POLLIN | POLLHUP))
+        {
+            // Escape sequences (arrow keys) arrive in a single read.
+            char    keys[16];
+            ssize_t r = read(STDIN_FILENO, keys, sizeof(keys));
+            if (r <= 0)
+            {
+                // stdin closed: keep serving resizes from the signal pipe.
+                stdin_open = false;
+            }
+            else if (keys[0] == 'q' || keys[0] == 'Q')
+            {
+                running = false;
+            }
+            else if (view->key != NULL && view->key(view->ctx, keys, (int)r) &&
+                     !pending)
+            {
+                view->draw(view->ctx, false);
+            }
+        }
+    }
+
+    writer_stop();
+    printf("\033[?25h");  // show cursor
+    fflush(stdout);
+    if (raw_tty)
+    {
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved_tio);
+    }
+    remove_handlers();
+    return 0;
+}
+
+struct resident_ctx
+{
+    print_img_image_t       image;
+    outbuf_t                frame;
+    const print_img_opts_t *opts;
+};
+
+static void resident_draw(void *arg, bool full)
+{
+    struct resident_ctx *ctx = (struct resident_ctx *)arg;
+    outbuf_puts(&ctx->frame, "\033[H");
+    print_img_render_buf(&ctx->image, ctx->opts, &ctx->frame);
+    writer_submit(&ctx->frame, full);
+}
+
+int print_img_resident(unsigned char          *img,
+                       int                     size,
+                       const print_img_opts_t *opts)
+{
+    struct resident_ctx ctx;
+    if (print_img_decode(img, size, opts, &ctx.image) != 0)
+    {
+        return -1;
+    }
+    ctx.opts = opts;
+    outbuf_init(&ctx.frame);
+
+    struct resident_view view = {resident_draw, NULL, &ctx};
+    int                  ret  = run_resident(&view);
+
+    outbuf_free(&ctx.frame);
+    print_img_image_free(&ctx.image);
+    return ret;
+}
+
+// Viewer: the visible part of the image is a window of the full resolution
+// image with the image's aspect ratio, so the output size never changes while
+// panning and zooming.
+#define VIEWER_MAX_ZOOM 64.0
+#define VIEWER_ZOOM_STEP 1.5
+#define VIEWER_PAN_STEP 0.25  // fraction of the window per key press
+
+struct viewer_ctx
+{
+    unsigned char          *base;  // full resolution RGB
+    int                     width;
+    int                     height;
+    pyramid_t              *pyr;
+    double                  zoom;  // 1 shows the whole image
+    double                  center_x;  // window center, level 0 pixels
+    double                  center_y;
+    unsigned char          *crop;
+    size_t                  crop_cap;
+    outbuf_t                frame;
+    print_img_opts_t        opts;  // knobs adjusted by rate
+    rate_ctl_t             *rate;  // NULL without a target frame rate
+};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void viewer_clamp(struct viewer_ctx *ctx)
+{
+    if (ctx->zoom < 1.0)
+    {
+        ctx->zoom = 1.0;
+    }
+    if (ctx->zoom > VIEWER_MAX_ZOOM)
+    {
+        ctx->zoom = VIEWER_MAX_ZOOM;
+    }
+
+    double half_w = ctx->width / ctx->zoom / 2;
+    double half_h = ctx->height / ctx->zoom / 2;
+    if (ctx->center_x < half_w)
+    {
+        ctx->center_x = half_w;
+    }
+    if (ctx->center_x > ctx->width - half_w)
+    {
+        ctx->center_x = ctx->width - half_w;
+    }
+    if (ctx->center_y < half_h)
+    {
+        ctx->center_y = half_h;
+    }
+    if (ctx->center_y > ctx->height - half_h)
+    {
+        ctx->center_y = ctx->height - half_h;
+    }
+}
+
+static void viewer_draw(void *arg, bool full)
+{
+    struct viewer_ctx *ctx = (struct viewer_ctx *)arg;
+
+    // Before anything is sized: the controller may change cell_scale.
+    if (ctx->rate != NULL && rate_ctl_apply(ctx->rate, &ctx->opts))
+    {
+        full = true;
+    }
+
+    unsigned int out_w, out_h;
+    print_img_output_size(ctx->width, ctx->height, &ctx->opts, &out_w, &out_h);
+
+    // Window in level 0 pixels.
+    double win_w = ctx->width / ctx->zoom;
+    double win_h = ctx->height / ctx->zoom;
+    double win_x = ctx->center_x - win_w / 2;
+    double win_y = ctx->center_y - win_h / 2;
+
+    // Smallest finished level that still has a source pixel per output pixel.
+    int level = 0;
+    int ready = pyramid_ready(ctx->pyr);
+    while (level + 1 < ready)
+    {
+        const pyramid_level_t *next = pyramid_level(ctx->pyr, level + 1);
+        double scale = (double)next->width / ctx->width;
+        if (win_w * scale < out_w || win_h * scale < out_h)
+        {
+            break;
+        }
+        level++;
+    }
+
+    const pyramid_level_t *lv = pyramid_level(ctx->pyr, level);
+    double                 sx = (double)lv->width / ctx->width;
+    double                 sy = (double)lv->height / ctx->height;
+
+    int x0 = (int)(win_x * sx);
+    int y0 = (int)(win_y * sy);
+    int x1 = (int)((win_x + win_w) * sx + 0.999);
+    int y1 = (int)((win_y + win_h) * sy + 0.999);
+    if (x1 > lv->width)
+    {
+        x1 = lv->width;
+    }
+    if (y1 > lv->height)
+    {
+        y1 = lv->height;
+    }
+    if (x1 <= x0)
+    {
+        x1 = x0 + 1;
+    }
+    if (y1 <= y0)
+    {
+        y1 = y0 + 1;
+    }
+
+    int    crop_w = x1 - x0;
+    int    crop_h = y1 - y0;
+    size_t need   = (size_t)crop_w * crop_h * 3;
+    if (need > ctx->crop_cap)
+    {
+        free(ctx->crop);
+        ctx->crop     = (unsigned char *)malloc(need);
+        ctx->crop_cap = need;
+    }
+    for (int y = 0; y < crop_h; y++)
+    {
+        memcpy(ctx->crop + (size_t)crop_w * 3 * y,
+               lv->pixels + ((size_t)lv->width * (y0 + y) + x0) * 3,
+               (size_t)crop_w * 3);
+    }
+
+    // Fit the output to the whole image, fill it with the window.
+    print_img_image_t image;
+    image.pixels     = ctx->crop;
+    image.width      = crop_w;
+    image.height     = crop_h;
+    image.channels   = 3;
+    image.src_width  = ctx->width;
+    image.src_height = ctx->height;
+
+    // Only draw a delta when the previous frame is sure to be on screen.
+    if (full || writer_has_pending())
+    {
+        print_img_frame_reset(ctx->opts.frame);
+    }
+
+    double start = now_seconds();
+    outbuf_puts(&ctx->frame, "\033[H");
+    print_img_render_buf(&image, &ctx->opts, &ctx->frame);
+    double render_seconds = now_seconds() - start;
+    size_t bytes          = ctx->frame.len;
+
+    writer_submit(&ctx->frame, full);
+    if (ctx->rate != NULL)
+    {
+        rate_ctl_update(ctx->rate, render_seconds, bytes);
+    }
+}
+
+static bool viewer_key(void *arg, const char *keys, int len)
+{
+    struct viewer_ctx *ctx = (struct viewer_ctx *)arg;
+    double             dx = 0, dy = 0;
+    double             zoom = ctx->zoom;
+
+    if (len >= 3 && keys[0] == '\033' && keys[1] == '[')
+    {
+        switch (keys[2])
+        {
+            case 'A':
+                dy = -1;
+                break;
+            case 'B':
+                dy = 1;
+                break;
+            case 'C':
+                dx = 1;
+                break;
+            case 'D':
+                dx = -1;
+                break;
+            default:
+                return false;
+        }
+    }
+    else
+    {
+        switch (keys[0])
+        {
+            case 'k':
+                dy = -1;
+                break;
+            case 'j':
+                dy = 1;
+                break;
+            case 'l':
+                dx = 1;
+                break;
+            case 'h':
+                dx = -1;
+                break;
+            case '+':
+            case '=':
+                zoom *= VIEWER_ZOOM_STEP;
+                break;
+            case '-':
+                zoom /= VIEWER_ZOOM_STEP;
+                break;
+            case '0':
+                zoom = 1.0;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    double old_x = ctx->center_x, old_y = ctx->center_y, old_zoom = ctx->zoom;
+    ctx->zoom = zoom;
+    ctx->center_x += dx * VIEWER_PAN_STEP * ctx->width / ctx->zoom;
+    ctx->center_y += dy * VIEWER_PAN_STEP * ctx->height / ctx->zoom;
+    viewer_clamp(ctx);
+
+    return ctx->center_x != old_x || ctx->center_y != old_y ||
+           ctx->zoom != old_zoom;
+}
+
+int print_img_viewer(unsigned char          *img,
+                     int                     size,
+                     const print_img_opts_t *opts,
+                     double                  fps)
+{
+    struct viewer_ctx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+
+    // Zooming in needs every source pixel. The pyramid is plain RGB, so
+    // transparency is composited once up front.
+    int file_w, file_h, file_channels;
+    if (!stbi_info_from_memory(img, size, &file_w, &file_h, &file_channels))
+    {
+        file_channels = 3;
+    }
+    int channels = file_channels == 2 || file_channels == 4 ? 4 : 3;
+    ctx.base = decode_image(img, size, &ctx.width, &ctx.height, channels, 0, 0,
+                            opts->exposure);
+    if (ctx.base == NULL)
+    {
+        fprintf(stderr, "Error reading image data!\n\n");
+        return -1;
+    }
+    if (channels == 4)
+    {
+        composite_alpha(ctx.base, ctx.base, (size_t)ctx.width * ctx.height, 4,
+                        opts->background);
+    }
+    ctx.pyr      = pyramid_create(ctx.base, ctx.width, ctx.height);
+    ctx.zoom     = 1.0;
+    ctx.center_x = ctx.width / 2.0;
+    ctx.center_y = ctx.height / 2.0;
+    ctx.opts       = *opts;
+    ctx.opts.frame = print_img_frame_create();
+    outbuf_init(&ctx.frame);
+
+    rate_ctl_t rate;
+    if (fps > 0)
+    {
+        rate_ctl_init(&rate, fps, &ctx.opts);
+        ctx.rate = &rate;
+    }
+
+    struct resident_view view = {viewer_draw, viewer_key, &ctx};
+    int                  ret  = run_resident(&view);
+
+    outbuf_free(&ctx.frame);
+    print_img_frame_free(ctx.opts.frame);
+    pyramid_destroy(ctx.pyr);
+    free(ctx.crop);
+    stbi_image_free(ctx.base);
+    return ret;
+}
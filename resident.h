@@ -0,0 +1,28 @@
+#ifndef _RESIDENT_H
+#define _RESIDENT_H
+
+#include "print_img.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Print the image and keep it decoded, redrawing it whenever the terminal is
+// resized. Returns when 'q' is pressed or on SIGINT/SIGTERM.
+int print_img_resident(unsigned char          *img,
+                       int                     size,
+                       const print_img_opts_t *opts);
+
+// Interactive pan/zoom view of the full resolution image: arrows or hjkl
+// pan, + and - zoom, 0 resets, q quits. Views are sampled from a mipmap
+// pyramid that is built in the background. With fps > 0 output quality
+// adapts to what the terminal link can carry at that rate.
+int print_img_viewer(unsigned char          *img,
+                     int                     size,
+                     const print_img_opts_t *opts,
+                     double                  fps);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,2183 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "img_decode.h"
+#include "img_resize.h"
+#include "outbuf.h"
+#include "print_img.h"
+#include "rate_ctl.h"
+#include "stb/stb_image.h"
+#include "stb/stb_image_resize.h"
+#include "worker_pool.h"
+
+// Differential check of the library against plain reference code: cell
+// grids against a frozen copy of the original glyph matcher, decoding
+// against stb_image, resizing against stbir and a naive area average, and
+// every parallel or cached path against the single-threaded one. Built as
+// pimg_check by `make check`, never shipped.
+
+// Divergences reported in full; the rest are only counted.
+#define CHECK_MAX_REPORTS 20
+
+#define CHECK_SEED 0x9e3779b9
+
+// Larger images are cropped to this for the resize checks.
+#define CHECK_RESIZE_MAX 400
+
+// Mutations of every encoded corpus file.
+#define CHECK_FUZZ_CASES 24
+
+// Reduced JPEG decodes use a scaled IDCT where the reference box averages
+// the full decode: they agree on average, not pixel for pixel.
+#define CHECK_REDUCED_MEAN 2.0
+#define CHECK_REDUCED_MAX  64
+
+struct check_config
+{
+    const char *name;
+    int         mode;
+    int         glyphs;
+    int         colors;
+    int         resample;
+    int         term_caps;
+};
+
+// Kitty output is left out: its pixels are covered by the resize checks.
+static const struct check_config CHECK_CONFIGS[] = {
+    {"block", PRINT_MODE_BLOCK, PRINT_GLYPHS_FULL, PRINT_COLORS_TRUE,
+     PRINT_RESAMPLE_AUTO, 0},
+    {"block stbir", PRINT_MODE_BLOCK, PRINT_GLYPHS_FULL, PRINT_COLORS_TRUE,
+     PRINT_RESAMPLE_STBIR, 0},
+    {"block area", PRINT_MODE_BLOCK, PRINT_GLYPHS_FULL, PRINT_COLORS_TRUE,
+     PRINT_RESAMPLE_AREA, 0},
+    {"block blocks", PRINT_MODE_BLOCK, PRINT_GLYPHS_BLOCKS, PRINT_COLORS_TRUE,
+     PRINT_RESAMPLE_AUTO, 0},
+    {"block half", PRINT_MODE_BLOCK, PRINT_GLYPHS_HALF, PRINT_COLORS_TRUE,
+     PRINT_RESAMPLE_AUTO, 0},
+    {"block sextant", PRINT_MODE_BLOCK, PRINT_GLYPHS_SEXTANT,
+     PRINT_COLORS_TRUE, PRINT_RESAMPLE_AUTO, 0},
+    {"block 256", PRINT_MODE_BLOCK, PRINT_GLYPHS_FULL, PRINT_COLORS_256,
+     PRINT_RESAMPLE_AUTO, 0},
+    {"block rep,ech", PRINT_MODE_BLOCK, PRINT_GLYPHS_FULL, PRINT_COLORS_TRUE,
+     PRINT_RESAMPLE_AUTO, PRINT_CAP_REP | PRINT_CAP_ECH},
+    {"compat", PRINT_MODE_COMPAT, PRINT_GLYPHS_FULL, PRINT_COLORS_TRUE,
+     PRINT_RESAMPLE_AUTO, 0},
+    {"compat 256", PRINT_MODE_COMPAT, PRINT_GLYPHS_FULL, PRINT_COLORS_256,
+     PRINT_RESAMPLE_AUTO, 0},
+    {"braille", PRINT_MODE_BRAILLE, PRINT_GLYPHS_FULL, PRINT_COLORS_TRUE,
+     PRINT_RESAMPLE_AUTO, 0},
+    {"octant", PRINT_MODE_OCTANT, PRINT_GLYPHS_FULL, PRINT_COLORS_TRUE,
+     PRINT_RESAMPLE_AUTO, 0},
+    {"ascii", PRINT_MODE_ASCII, PRINT_GLYPHS_FULL, PRINT_COLORS_TRUE,
+     PRINT_RESAMPLE_AUTO, 0},
+};
+
+// Terminal sizes to fit to, odd ones included.
+static const int CHECK_TERMS[][2] = {{80, 24}, {13, 7}, {123, 37}};
+
+// Sizes of the generated images, most of them not a multiple of a cell.
+static const int CHECK_SIZES[][2] = {
+    {1, 1},   {3, 7},    {4, 8},    {5, 9},     {17, 3},
+    {31, 17}, {64, 64},  {97, 61},  {257, 129}, {333, 187},
+};
+
+// Sizes of the encoded files; the larger one has enough restart intervals
+// for the parallel JPEG entropy decoder.
+static const int CHECK_FILE_SIZES[][2] = {{61, 37}, {203, 117}};
+
+struct check_image
+{
+    char              name[64];
+    print_img_image_t image;
+};
+
+struct check_file
+{
+    char           name[64];
+    unsigned char *data;
+    int            len;
+};
+
+struct check_state
+{
+    int      checks;
+    int      divergences;
+    int      two_tone_cells;  // drawn in their colors, not averages
+    uint32_t rng;
+    outbuf_t ref;
+    outbuf_t out;
+};
+
+static void check_report(struct check_state *st, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void check_report(struct check_state *st, const char *fmt, ...)
+{
+    if (st->divergences++ < CHECK_MAX_REPORTS)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        fputs("check: ", stderr);
+        vfprintf(stderr, fmt, ap);
+        fputc('\n', stderr);
+        va_end(ap);
+    }
+}
+
+static uint32_t check_rand(struct check_state *st)
+{
+    st->rng ^= st->rng << 13;
+    st->rng ^= st->rng >> 17;
+    st->rng ^= st->rng << 5;
+    return st->rng;
+}
+
+static inline int luma(const unsigned char *rgb)
+{
+    return (rgb[0] * 77 + rgb[1] * 150 + rgb[2] * 29) >> 8;
+}
+
+// Encoders for the file corpus. They only need to produce valid files, so
+// they take the simplest route: stored deflate blocks for PNG, flat Huffman
+// tables and a float DCT for JPEG.
+
+static void put_be16(outbuf_t *out, unsigned int v)
+{
+    unsigned char b[2] = {(unsigned char)(v >> 8), (unsigned char)v};
+    outbuf_write(out, b, 2);
+}
+
+static void put_be32(outbuf_t *out, uint32_t v)
+{
+    put_be16(out, v >> 16);
+    put_be16(out, v & 0xffff);
+}
+
+static uint32_t crc32_update(uint32_t crc, const unsigned char *p, size_t n)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++)
+    {
+        crc ^= p[i];
+        for (int k = 0; k < 8; k++)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+static void png_chunk(outbuf_t            *out,
+                      const char          *type,
+                      const unsigned char *data,
+                      size_t               len)
+{
+    put_be32(out, (uint32_t)len);
+    size_t start = out->len;
+    outbuf_write(out, type, 4);
+    outbuf_write(out, data, len);
+    put_be32(out, crc32_update(0, (unsigned char *)out->data + start,
+                               len + 4));
+}
+
+// samples holds width * height * channels values of the given bit depth.
+static void png_encode(outbuf_t       *out,
+                       const uint16_t *samples,
+                       int             width,
+                       int             height,
+                       int             channels,
+                       int             depth)
+{
+    static const unsigned char COLOR_TYPE[] = {0, 0, 4, 2, 6};
+
+    outbuf_t raw;
+    outbuf_init(&raw);
+    for (int y = 0; y < height; y++)
+    {
+        unsigned char filter = 0;
+        outbuf_write(&raw, &filter, 1);
+        for (int i = 0; i < width * channels; i++)
+        {
+            uint16_t v = samples[(size_t)y * width * channels + i];
+            if (depth == 16)
+            {
+                put_be16(&raw, v);
+            }
+            else
+            {
+                unsigned char b = (unsigned char)v;
+                outbuf_write(&raw, &b, 1);
+            }
+        }
+    }
+
+    // zlib stream of stored blocks.
+    outbuf_t z;
+    outbuf_init(&z);
+    unsigned char zhead[2] = {0x78, 0x01};
+    outbuf_write(&z, zhead, 2);
+    uint32_t s1 = 1, s2 = 0;
+    for (size_t off = 0; off < raw.len; off += 65535)
+    {
+        size_t        n      = raw.len - off < 65535 ? raw.len - off : 65535;
+        unsigned char head[5] = {
+            (unsigned char)(off + n == raw.len),
+            (unsigned char)n,
+            (unsigned char)(n >> 8),
+            (unsigned char)~n,
+            (unsigned char)(~n >> 8),
+        };
+        outbuf_write(&z, head, 5);
+        outbuf_write(&z, raw.data + off, n);
+        for (size_t i = 0; i < n; i++)
+        {
+            s1 = (s1 + (unsigned char)raw.data[off + i]) % 65521;
+            s2 = (s2 + s1) % 65521;
+        }
+    }
+    put_be32(&z, (s2 << 16) | s1);
+
+    unsigned char ihdr[13];
+    ihdr[0]  = (unsigned char)(width >> 24);
+    ihdr[1]  = (unsigned char)(width >> 16);
+    ihdr[2]  = (unsigned char)(width >> 8);
+    ihdr[3]  = (unsigned char)width;
+    ihdr[4]  = (unsigned char)(height >> 24);
+    ihdr[5]  = (unsigned char)(height >> 16);
+    ihdr[6]  = (unsigned char)(height >> 8);
+    ihdr[7]  = (unsigned char)height;
+    ihdr[8]  = (unsigned char)depth;
+    ihdr[9]  = COLOR_TYPE[channels];
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+    outbuf_write(out, "\x89PNG\r\n\x1a\n", 8);
+    png_chunk(out, "IHDR", ihdr, sizeof(ihdr));
+    png_chunk(out, "IDAT", (unsigned char *)z.data, z.len);
+    png_chunk(out, "IEND", (const unsigned char *)"", 0);
+
+    outbuf_free(&raw);
+    outbuf_free(&z);
+}
+
+static void pnm_encode(outbuf_t            *out,
+                       const unsigned char *px,
+                       int                  width,
+                       int                  height,
+                       int                  channels)
+{
+    outbuf_printf(out, "P%d\n%d %d\n255\n", channels == 1 ? 5 : 6, width,
+                  height);
+    outbuf_write(out, px, (size_t)width * height * channels);
+}
+
+// Standard luminance table, natural order, used for every component.
+static const unsigned char JPEG_QUANT[64] = {
+    16, 11, 10,  16,  24,  40,  51,  61,  12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16,  24,  40,  57,  69,  56,  14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37,  56,  68,  109, 103, 77,  24, 35, 55, 64,  81,  104, 113, 92,
+    49, 64, 78,  87,  103, 121, 120, 101, 72, 92, 95, 98,  112, 100, 103, 99,
+};
+
+// Flat Huffman tables: DC sizes 0..11 get 4-bit codes, the 162 AC symbols
+// (EOB, ZRL and run/size pairs) 8-bit codes in this order.
+#define JPEG_AC_SYMBOLS 162
+
+struct jpeg_bits
+{
+    outbuf_t *out;
+    uint32_t  acc;
+    int       count;
+};
+
+static void jpeg_put_bits(struct jpeg_bits *bw, uint32_t code, int len)
+{
+    bw->acc = (bw->acc << len) | (code & ((1u << len) - 1));
+    bw->count += len;
+    while (bw->count >= 8)
+    {
+        unsigned char b = (unsigned char)(bw->acc >> (bw->count - 8));
+        outbuf_write(bw->out, &b, 1);
+        if (b == 0xff)
+        {
+            unsigned char stuffed = 0;
+            outbuf_write(bw->out, &stuffed, 1);
+        }
+        bw->count -= 8;
+    }
+    bw->acc &= (1u << bw->count) - 1;
+}
+
+// Pad the last byte with ones.
+static void jpeg_flush_bits(struct jpeg_bits *bw)
+{
+    if (bw->count > 0)
+    {
+        jpeg_put_bits(bw, 0x7f, 8 - bw->count);
+    }
+}
+
+static int jpeg_size(int v)
+{
+    int size = 0;
+    for (v = v < 0 ? -v : v; v > 0; v >>= 1)
+    {
+        size++;
+    }
+    return size;
+}
+
+static void jpeg_put_value(struct jpeg_bits *bw, int v, int size)
+{
+    jpeg_put_bits(bw, (uint32_t)(v < 0 ? v + (1 << size) - 1 : v), size);
+}
+
+// zigzag[k] is the natural index of the k-th coefficient in scan order.
+static void jpeg_zigzag(int *zigzag)
+{
+    int k = 0;
+    for (int s = 0; s < 15; s++)
+    {
+        for (int i = 0; i <= s; i++)
+        {
+            int row = s % 2 == 0 ? s - i : i;
+            int col = s - row;
+            if (row < 8 && col < 8)
+            {
+                zigzag[k++] = row * 8 + col;
+            }
+        }
+    }
+}
+
+struct jpeg_encoder
+{
+    struct jpeg_bits bits;
+    int              zigzag[64];
+    int              quant[64];
+    int              ac_code[256];
+    float            cos_table[8][8];
+};
+
+static void jpeg_encode_block(struct jpeg_encoder *enc,
+                              const float          block[64],
+                              int                 *dc_pred)
+{
+    float tmp[64], coef[64];
+    for (int y = 0; y < 8; y++)
+    {
+        for (int u = 0; u < 8; u++)
+        {
+            float sum = 0;
+            for (int x = 0; x < 8; x++)
+            {
+                sum += block[y * 8 + x] * enc->cos_table[x][u];
+            }
+            tmp[y * 8 + u] = sum;
+        }
+    }
+    for (int u = 0; u < 8; u++)
+    {
+        for (int v = 0; v < 8; v++)
+        {
+            float sum = 0;
+            for (int y = 0; y < 8; y++)
+            {
+                sum += tmp[y * 8 + u] * enc->cos_table[y][v];
+            }
+            coef[v * 8 + u] = sum / 4;
+        }
+    }
+
+    int q[64];
+    for (int k = 0; k < 64; k++)
+    {
+        int n = enc->zigzag[k];
+        q[k]  = (int)lroundf(coef[n] / enc->quant[n]);
+    }
+
+    int diff = q[0] - *dc_pred;
+    int size = jpeg_size(diff);
+    *dc_pred = q[0];
+    jpeg_put_bits(&enc->bits, size, 4);
+    jpeg_put_value(&enc->bits, diff, size);
+
+    int run = 0;
+    for (int k = 1; k < 64; k++)
+    {
+        if (q[k] == 0)
+        {
+            run++;
+            continue;
+        }
+        for (; run > 15; run -= 16)
+        {
+            jpeg_put_bits(&enc->bits, enc->ac_code[0xf0], 8);
+        }
+        size = jpeg_size(q[k]);
+        jpeg_put_bits(&enc->bits, enc->ac_code[(run << 4) | size], 8);
+        jpeg_put_value(&enc->bits, q[k], size);
+        run = 0;
+    }
+    if (run > 0)
+    {
+        jpeg_put_bits(&enc->bits, enc->ac_code[0x00], 8);
+    }
+}
+
+// Baseline JPEG of packed luma or RGB. Chroma is averaged over sub x sub
+// pixels (1 for 4:4:4, 2 for 4:2:0); restart is the DRI interval in MCUs,
+// 0 for none.
+static void jpeg_encode(outbuf_t            *out,
+                        const unsigned char *px,
+                        int                  width,
+                        int                  height,
+                        int                  channels,
+                        int                  sub,
+                        int                  restart)
+{
+    struct jpeg_encoder enc;
+    memset(&enc, 0, sizeof(enc));
+    enc.bits.out = out;
+    jpeg_zigzag(enc.zigzag);
+    for (int i = 0; i < 64; i++)
+    {
+        int q        = (JPEG_QUANT[i] * 50 + 50) / 100;
+        enc.quant[i] = q < 1 ? 1 : q;
+    }
+    for (int x = 0; x < 8; x++)
+    {
+        for (int u = 0; u < 8; u++)
+        {
+            enc.cos_table[x][u] = cosf((2 * x + 1) * u * (float)M_PI / 16) *
+                                  (u == 0 ? (float)M_SQRT1_2 : 1.0f);
+        }
+    }
+
+    unsigned char ac_symbols[JPEG_AC_SYMBOLS];
+    int           n = 0;
+    ac_symbols[n++] = 0x00;
+    ac_symbols[n++] = 0xf0;
+    for (int r = 0; r < 16; r++)
+    {
+        for (int s = 1; s <= 10; s++)
+        {
+            ac_symbols[n++] = (unsigned char)((r << 4) | s);
+        }
+    }
+    for (int i = 0; i < JPEG_AC_SYMBOLS; i++)
+    {
+        enc.ac_code[ac_symbols[i]] = i;
+    }
+
+    // Level shifted Y (Cb Cr) planes.
+    int    comps  = channels == 1 ? 1 : 3;
+    sub           = comps == 1 ? 1 : sub;
+    float *planes = (float *)malloc((size_t)width * height * comps *
+                                    sizeof(float));
+    for (size_t i = 0; i < (size_t)width * height; i++)
+    {
+        const unsigned char *p = px + i * channels;
+        float               *d = planes + i * comps;
+        if (comps == 1)
+        {
+            d[0] = p[0] - 128.0f;
+            continue;
+        }
+        d[0] = 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2] - 128;
+        d[1] = -0.168736f * p[0] - 0.331264f * p[1] + 0.5f * p[2];
+        d[2] = 0.5f * p[0] - 0.418688f * p[1] - 0.081312f * p[2];
+    }
+
+    unsigned char soi[2] = {0xff, 0xd8};
+    outbuf_write(out, soi, 2);
+
+    put_be16(out, 0xffdb);
+    put_be16(out, 67);
+    unsigned char table = 0;
+    outbuf_write(out, &table, 1);
+    for (int k = 0; k < 64; k++)
+    {
+        unsigned char q = (unsigned char)enc.quant[enc.zigzag[k]];
+        outbuf_write(out, &q, 1);
+    }
+
+    put_be16(out, 0xffc0);
+    put_be16(out, 8 + 3 * comps);
+    unsigned char precision = 8;
+    outbuf_write(out, &precision, 1);
+    put_be16(out, height);
+    put_be16(out, width);
+    unsigned char ncomp = (unsigned char)comps;
+    outbuf_write(out, &ncomp, 1);
+    for (int c = 0; c < comps; c++)
+    {
+        unsigned char f    = (unsigned char)(c == 0 ? sub : 1);
+        unsigned char d[3] = {(unsigned char)(c + 1),
+                              (unsigned char)((f << 4) | f), 0};
+        outbuf_write(out, d, 3);
+    }
+
+    put_be16(out, 0xffc4);
+    put_be16(out, 2 + 17 + 12 + 17 + JPEG_AC_SYMBOLS);
+    unsigned char counts[17] = {0x00};
+    counts[4]                = 12;
+    outbuf_write(out, counts, 17);
+    for (unsigned char s = 0; s < 12; s++)
+    {
+        outbuf_write(out, &s, 1);
+    }
+    memset(counts, 0, sizeof(counts));
+    counts[0] = 0x10;
+    counts[8] = JPEG_AC_SYMBOLS;
+    outbuf_write(out, counts, 17);
+    outbuf_write(out, ac_symbols, JPEG_AC_SYMBOLS);
+
+    if (restart > 0)
+    {
+        put_be16(out, 0xffdd);
+        put_be16(out, 4);
+        put_be16(out, restart);
+    }
+
+    put_be16(out, 0xffda);
+    put_be16(out, 6 + 2 * comps);
+    outbuf_write(out, &ncomp, 1);
+    for (int c = 0; c < comps; c++)
+    {
+        unsigned char d[2] = {(unsigned char)(c + 1), 0};
+        outbuf_write(out, d, 2);
+    }
+    unsigned char spectral[3] = {0, 63, 0};
+    outbuf_write(out, spectral, 3);
+
+    int mcu     = 8 * sub;
+    int mcus_x  = (width + mcu - 1) / mcu;
+    int mcus_y  = (height + mcu - 1) / mcu;
+    int pred[3] = {0};
+    int marker  = 0;
+    for (int m = 0; m < mcus_x * mcus_y; m++)
+    {
+        if (restart > 0 && m > 0 && m % restart == 0)
+        {
+            jpeg_flush_bits(&enc.bits);
+            put_be16(out, 0xffd0 + marker);
+            marker  = (marker + 1) & 7;
+            pred[0] = pred[1] = pred[2] = 0;
+        }
+
+        for (int c = 0; c < comps; c++)
+        {
+            // Blocks per MCU and pixels per sample of this component.
+            int f = c == 0 ? sub : 1;
+            int s = sub / f;
+            for (int by = 0; by < f; by++)
+            {
+                for (int bx = 0; bx < f; bx++)
+                {
+                    float block[64];
+                    int   x0 = (m % mcus_x) * mcu / s + bx * 8;
+                    int   y0 = (m / mcus_x) * mcu / s + by * 8;
+                    for (int i = 0; i < 64; i++)
+                    {
+                        float sum = 0;
+                        for (int j = 0; j < s * s; j++)
+                        {
+                            int x = (x0 + i % 8) * s + j % s;
+                            int y = (y0 + i / 8) * s + j / s;
+                            x     = x < width ? x : width - 1;
+                            y     = y < height ? y : height - 1;
+                            sum += planes[((size_t)y * width + x) * comps + c];
+                        }
+                        block[i] = sum / (s * s);
+                    }
+                    jpeg_encode_block(&enc, block, &pred[c]);
+                }
+            }
+        }
+    }
+    jpeg_flush_bits(&enc.bits);
+
+    unsigned char eoi[2] = {0xff, 0xd9};
+    outbuf_write(out, eoi, 2);
+    free(planes);
+}
+
+// Frozen copy of the original glyph matcher (as built, without
+// USING_CPP_MAP) and its table up to the end of the regular characters,
+// which is as far as it ever searched. Block mode cells must match it.
+
+typedef struct
+{
+    int fg_color[3];
+    int bg_color[3];
+    int codepoint;
+    int diff;  // bitmap pixels the glyph misses, 8 for the U+2584 fallback
+} ref_chardata_t;
+
+static const unsigned int REF_BITMAPS[] = {
+    0x00000000, 0x00a0,
+
+    // Block graphics
+    // 0xffff0000, 0x2580,  // upper 1/2; redundant with inverse lower 1/2
+
+    0x0000000f, 0x2581,                      // lower 1/8
+    0x000000ff, 0x2582,                      // lower 1/4
+    0x00000fff, 0x2583, 0x0000ffff, 0x2584,  // lower 1/2
+    0x000fffff, 0x2585, 0x00ffffff, 0x2586,  // lower 3/4
+    0x0fffffff, 0x2587,
+    // 0xffffffff, 0x2588,  // full; redundant with inverse space
+
+    0xeeeeeeee, 0x258a,  // left 3/4
+    0xcccccccc, 0x258c,  // left 1/2
+    0x88888888, 0x258e,  // left 1/4
+
+    0x0000cccc, 0x2596,  // quadrant lower left
+    0x00003333, 0x2597,  // quadrant lower right
+    0xcccc0000, 0x2598,  // quadrant upper left
+    // 0xccccffff, 0x2599,  // 3/4 redundant with inverse 1/4
+    0xcccc3333, 0x259a,  // diagonal 1/2
+                         // 0xffffcccc, 0x259b,  // 3/4 redundant
+    // 0xffff3333, 0x259c,  // 3/4 redundant
+    0x33330000, 0x259d,  // quadrant upper right
+                         // 0x3333cccc, 0x259e,  // 3/4 redundant
+    // 0x3333ffff, 0x259f,  // 3/4 redundant
+
+    // Line drawing subset: no double lines, no complex light lines
+
+    0x000ff000, 0x2501,  // Heavy horizontal
+    0x66666666, 0x2503,  // Heavy vertical
+
+    0x00077666, 0x250f,  // Heavy down and right
+    0x000ee666, 0x2513,  // Heavy down and left
+    0x66677000, 0x2517,  // Heavy up and right
+    0x666ee000, 0x251b,  // Heavy up and left
+
+    0x66677666, 0x2523,  // Heavy vertical and right
+    0x666ee666, 0x252b,  // Heavy vertical and left
+    0x000ff666, 0x2533,  // Heavy down and horizontal
+    0x666ff000, 0x253b,  // Heavy up and horizontal
+    0x666ff666, 0x254b,  // Heavy cross
+
+    0x000cc000, 0x2578,  // Bold horizontal left
+    0x00066000, 0x2579,  // Bold horizontal up
+    0x00033000, 0x257a,  // Bold horizontal right
+    0x00066000, 0x257b,  // Bold horizontal down
+
+    0x06600660, 0x254f,  // Heavy double dash vertical
+
+    0x000f0000, 0x2500,  // Light horizontal
+    0x0000f000, 0x2500,  //
+    0x44444444, 0x2502,  // Light vertical
+    0x22222222, 0x2502,
+
+    0x000e0000, 0x2574,  // light left
+    0x0000e000, 0x2574,  // light left
+    0x44440000, 0x2575,  // light up
+    0x22220000, 0x2575,  // light up
+    0x00030000, 0x2576,  // light right
+    0x00003000, 0x2576,  // light right
+    0x00004444, 0x2577,  // light down
+    0x00002222, 0x2577,  // light down
+
+    // Misc technical
+
+    0x44444444, 0x23a2,  // [ extension
+    0x22222222, 0x23a5,  // ] extension
+
+    0x0f000000, 0x23ba,  // Horizontal scanline 1
+    0x00f00000, 0x23bb,  // Horizontal scanline 3
+    0x00000f00, 0x23bc,  // Horizontal scanline 7
+    0x000000f0, 0x23bd,  // Horizontal scanline 9
+
+    // Geometrical shapes. Tricky because some of them are too wide.
+
+    // 0x00ffff00, 0x25fe,  // Black medium small square
+    0x00066000, 0x25aa,  // Black small square
+
+    // 0x11224488, 0x2571,  // diagonals
+    // 0x88442211, 0x2572,
+    // 0x99666699, 0x2573,
+    // 0x000137f0, 0x25e2,  // Triangles
+    // 0x0008cef0, 0x25e3,
+    // 0x000fec80, 0x25e4,
+    // 0x000f7310, 0x25e5,
+
+    0, 0,  // End marker for "regular" characters
+};
+
+static int ref_bitcount(unsigned int n)
+{
+    int count = 0;
+    while (n)
+    {
+        if (n & 1)
+            count++;
+        n = n >> 1;
+    }
+    return count;
+}
+
+static ref_chardata_t ref_create_chardata(const unsigned char *rgbraw,
+                                          int                  x0,
+                                          int                  y0,
+                                          int                  width,
+                                          int                  codepoint,
+                                          unsigned int         pattern)
+{
+    ref_chardata_t result;
+    memset(&result, 0, sizeof(result));
+    result.codepoint  = codepoint;
+    int          fg_count = 0;
+    int          bg_count = 0;
+    unsigned int mask     = 0x80000000;
+
+    for (int y = 0; y < 8; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            int *avg;
+            if (pattern & mask)
+            {
+                avg = result.fg_color;
+                fg_count++;
+            }
+            else
+            {
+                avg = result.bg_color;
+                bg_count++;
+            }
+            const unsigned char *p = rgbraw + ((x0 + x) + width * (y0 + y)) * 3;
+            for (int i = 0; i < 3; i++)
+            {
+                avg[i] += p[i];
+            }
+            mask = mask >> 1;
+        }
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (bg_count != 0)
+        {
+            result.bg_color[i] /= bg_count;
+        }
+        if (fg_count != 0)
+        {
+            result.fg_color[i] /= fg_count;
+        }
+    }
+    return result;
+}
+
+static ref_chardata_t ref_find_chardata(const unsigned char *rgbraw,
+                                        int                  x0,
+                                        int                  y0,
+                                        int                  width)
+{
+    int min[3] = {255, 255, 255};
+    int max[3] = {0};
+
+    for (int y = 0; y < 8; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            const unsigned char *p = rgbraw + ((x0 + x) + width * (y0 + y)) * 3;
+            for (int i = 0; i < 3; i++)
+            {
+                min[i] = p[i] < min[i] ? p[i] : min[i];
+                max[i] = p[i] > max[i] ? p[i] : max[i];
+            }
+        }
+    }
+
+    // Split at the middle of the channel with the greatest range.
+    int split_index = 0;
+    int best_split  = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        if (max[i] - min[i] > best_split)
+        {
+            best_split  = max[i] - min[i];
+            split_index = i;
+        }
+    }
+    int split_value = min[split_index] + best_split / 2;
+
+    unsigned int bits = 0;
+    for (int y = 0; y < 8; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            bits = bits << 1;
+            if (rgbraw[((x0 + x) + width * (y0 + y)) * 3 + split_index] >
+                split_value)
+            {
+                bits |= 1;
+            }
+        }
+    }
+
+    int          best_diff    = 8;
+    unsigned int best_pattern = 0x0000ffff;
+    int          codepoint    = 0x2584;
+    for (int i = 0; REF_BITMAPS[i + 1] != 0; i += 2)
+    {
+        if (REF_BITMAPS[i + 1] < 32)
+        {
+            continue;
+        }
+        unsigned int pattern = REF_BITMAPS[i];
+        for (int j = 0; j < 2; j++)
+        {
+            int diff = ref_bitcount(pattern ^ bits);
+            if (diff < best_diff)
+            {
+                best_pattern = REF_BITMAPS[i];  // pattern might be inverted.
+                codepoint    = REF_BITMAPS[i + 1];
+                best_diff    = diff;
+            }
+            pattern = ~pattern;
+        }
+    }
+
+    ref_chardata_t result =
+        ref_create_chardata(rgbraw, x0, y0, width, codepoint, best_pattern);
+    result.diff = best_diff;
+    return result;
+}
+
+// Pattern of the n-th regular glyph, counting round the table.
+static unsigned int ref_nth_pattern(uint32_t n)
+{
+    int glyphs = 0;
+    for (int i = 0; REF_BITMAPS[i + 1] != 0; i += 2)
+    {
+        glyphs += REF_BITMAPS[i + 1] >= 32;
+    }
+    n %= glyphs;
+    for (int i = 0;; i += 2)
+    {
+        if (REF_BITMAPS[i + 1] >= 32 && n-- == 0)
+        {
+            return REF_BITMAPS[i];
+        }
+    }
+}
+
+// Reference resizers: stbir called the plain way, and a naive area average
+// in doubles. Both follow resize_image()'s documented choice of method.
+
+// img_resize.cpp's AREA_RESAMPLE_MIN_RATIO.
+#define CHECK_AREA_MIN_RATIO 4
+
+static void ref_background(int background, int channels, int *bg)
+{
+    unsigned char rgb[3] = {(unsigned char)(background >> 16),
+                            (unsigned char)(background >> 8),
+                            (unsigned char)background};
+    for (int c = 0; c < 3; c++)
+    {
+        bg[c] = channels == 1 ? luma(rgb) : rgb[c];
+    }
+}
+
+static void ref_composite(const unsigned char *src,
+                          unsigned char       *dst,
+                          size_t               pixels,
+                          int                  channels,
+                          int                  background)
+{
+    int color = channels - 1;
+    int bg[3];
+    ref_background(background, color, bg);
+    for (size_t i = 0; i < pixels; i++)
+    {
+        const unsigned char *p = src + i * channels;
+        for (int c = 0; c < color; c++)
+        {
+            double v = (p[c] * p[color] + bg[c] * (255.0 - p[color])) / 255;
+            dst[i * color + c] = (unsigned char)floor(v + 0.5);
+        }
+    }
+}
+
+static void ref_resize_area(const unsigned char *src,
+                            int                  src_w,
+                            int                  src_h,
+                            unsigned char       *dst,
+                            int                  dst_w,
+                            int                  dst_h,
+                            int                  channels,
+                            int                  background)
+{
+    bool alpha = channels % 2 == 0;
+    int  color = alpha ? channels - 1 : channels;
+    int  bg[3];
+    ref_background(background, color, bg);
+
+    for (int dy = 0; dy < dst_h; dy++)
+    {
+        int y0 = (int)((int64_t)dy * src_h / dst_h);
+        int y1 = (int)((int64_t)(dy + 1) * src_h / dst_h);
+        for (int dx = 0; dx < dst_w; dx++)
+        {
+            int    x0 = (int)((int64_t)dx * src_w / dst_w);
+            int    x1 = (int)((int64_t)(dx + 1) * src_w / dst_w);
+            double n  = (double)(x1 - x0) * (y1 - y0);
+
+            double a = 0;
+            for (int y = y0; y < y1; y++)
+            {
+                for (int x = x0; x < x1; x++)
+                {
+                    a += alpha ? src[((size_t)y * src_w + x) * channels +
+                                     color]
+                               : 255;
+                }
+            }
+
+            for (int c = 0; c < color; c++)
+            {
+                double sum = 0;
+                for (int y = y0; y < y1; y++)
+                {
+                    for (int x = x0; x < x1; x++)
+                    {
+                        const unsigned char *p =
+                            src + ((size_t)y * src_w + x) * channels;
+                        sum += alpha ? p[c] * p[color] : p[c] * 255.0;
+                    }
+                }
+                double v = (sum + bg[c] * (255 * n - a)) / (255 * n);
+                dst[((size_t)dy * dst_w + dx) * color + c] =
+                    (unsigned char)floor(v + 0.5);
+            }
+        }
+    }
+}
+
+static void ref_resize(const unsigned char *src,
+                       int                  src_w,
+                       int                  src_h,
+                       unsigned char       *dst,
+                       int                  dst_w,
+                       int                  dst_h,
+                       int                  channels,
+                       int                  resample,
+                       int                  background)
+{
+    if (resample == PRINT_RESAMPLE_AUTO)
+    {
+        resample = src_w >= dst_w * CHECK_AREA_MIN_RATIO &&
+                           src_h >= dst_h * CHECK_AREA_MIN_RATIO
+                       ? PRINT_RESAMPLE_AREA
+                       : PRINT_RESAMPLE_STBIR;
+    }
+    if (src_w < dst_w || src_h < dst_h)
+    {
+        resample = PRINT_RESAMPLE_STBIR;
+    }
+
+    size_t pixels = (size_t)dst_w * dst_h;
+    bool   alpha  = channels % 2 == 0;
+    if (alpha && src_w == dst_w && src_h == dst_h)
+    {
+        ref_composite(src, dst, pixels, channels, background);
+    }
+    else if (resample == PRINT_RESAMPLE_AREA)
+    {
+        ref_resize_area(src, src_w, src_h, dst, dst_w, dst_h, channels,
+                        background);
+    }
+    else if (alpha)
+    {
+        unsigned char *tmp = (unsigned char *)malloc(pixels * channels);
+        stbir_resize_uint8_generic(src, src_w, src_h, 0, tmp, dst_w, dst_h,
+                                   0, channels, channels - 1, 0,
+                                   STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT,
+                                   STBIR_COLORSPACE_LINEAR, NULL);
+        ref_composite(tmp, dst, pixels, channels, background);
+        free(tmp);
+    }
+    else
+    {
+        stbir_resize_uint8(src, src_w, src_h, 0, dst, dst_w, dst_h, 0,
+                           channels);
+    }
+}
+
+// Reference decode: stb_image at full size, box averaged over 2^shift
+// blocks. 16-bit samples are averaged before they are narrowed, weighted by
+// alpha when there is one; transparent blocks come out black.
+static unsigned char *ref_decode(const unsigned char *buf,
+                                 int                  len,
+                                 int                 *width,
+                                 int                 *height,
+                                 int                  channels,
+                                 int                  shift)
+{
+    int             w, h, file_channels;
+    uint16_t       *wide = NULL;
+    unsigned char  *full = NULL;
+    if (stbi_is_16_bit_from_memory(buf, len))
+    {
+        wide = stbi_load_16_from_memory(buf, len, &w, &h, &file_channels,
+                                        channels);
+    }
+    else
+    {
+        full = stbi_load_from_memory(buf, len, &w, &h, &file_channels,
+                                     channels);
+    }
+    if (wide == NULL && full == NULL)
+    {
+        return NULL;
+    }
+    // decode_image() refuses the 0x0 images stb_image makes of some
+    // truncated headers.
+    if (w < 1 || h < 1)
+    {
+        stbi_image_free(wide);
+        stbi_image_free(full);
+        return NULL;
+    }
+    if (full != NULL && shift == 0)
+    {
+        *width  = w;
+        *height = h;
+        return full;
+    }
+
+    bool           alpha = wide != NULL && channels % 2 == 0;
+    int            color = alpha ? channels - 1 : channels;
+    double         range = wide != NULL ? 65535 : 255;
+    int            dw    = (w + (1 << shift) - 1) >> shift;
+    int            dh    = (h + (1 << shift) - 1) >> shift;
+    unsigned char *dst = (unsigned char *)malloc((size_t)dw * dh * channels);
+    for (int dy = 0; dy < dh; dy++)
+    {
+        for (int dx = 0; dx < dw; dx++)
+        {
+            double sum[4] = {0};
+            int    n      = 0;
+            for (int y = dy << shift; y < h && y < (dy + 1) << shift; y++)
+            {
+                for (int x = dx << shift; x < w && x < (dx + 1) << shift; x++)
+                {
+                    size_t i = ((size_t)y * w + x) * channels;
+                    double a = alpha ? wide[i + color] / range : 1;
+                    for (int c = 0; c < channels; c++)
+                    {
+                        double v = wide != NULL ? wide[i + c] : full[i + c];
+                        sum[c] += c < color ? v * a : v;
+                    }
+                    n++;
+                }
+            }
+
+            unsigned char *out = dst + ((size_t)dy * dw + dx) * channels;
+            for (int c = 0; c < channels; c++)
+            {
+                double weight = c < color && alpha ? sum[color] / range : n;
+                double v = weight > 0 ? sum[c] / weight * 255 / range : 0;
+                out[c]   = (unsigned char)floor(v + 0.5);
+            }
+        }
+    }
+    stbi_image_free(wide);
+    stbi_image_free(full);
+    *width  = dw;
+    *height = dh;
+    return dst;
+}
+
+// Generated images: noise, 4x8 tiles of two random colors in a random
+// pattern, and smooth gradients.
+
+static unsigned char *new_pixels(struct check_image *ci,
+                                 int                 width,
+                                 int                 height,
+                                 const char         *kind)
+{
+    snprintf(ci->name, sizeof(ci->name), "%s %dx%d", kind, width, height);
+    ci->image.width      = width;
+    ci->image.height     = height;
+    ci->image.channels   = 3;
+    ci->image.src_width  = width;
+    ci->image.src_height = height;
+    ci->image.pixels     = (unsigned char *)malloc((size_t)width * height * 3);
+    return ci->image.pixels;
+}
+
+static int make_corpus(struct check_state *st, struct check_image *corpus)
+{
+    int count = 0;
+    for (size_t s = 0; s < sizeof(CHECK_SIZES) / sizeof(CHECK_SIZES[0]); s++)
+    {
+        int w = CHECK_SIZES[s][0];
+        int h = CHECK_SIZES[s][1];
+
+        unsigned char *px = new_pixels(&corpus[count++], w, h, "noise");
+        for (size_t i = 0; i < (size_t)w * h * 3; i++)
+        {
+            px[i] = (unsigned char)check_rand(st);
+        }
+
+        // Cells of one color, of exactly a glyph or its inverse, and of two
+        // colors in any pattern.
+        px = new_pixels(&corpus[count++], w, h, "two-tone");
+        for (int ty = 0; ty < h; ty += 8)
+        {
+            for (int tx = 0; tx < w; tx += 4)
+            {
+                uint32_t colors[2] = {check_rand(st), check_rand(st)};
+                uint32_t pattern   = check_rand(st);
+                uint32_t kind      = check_rand(st) & 3;
+                if (kind == 0)
+                {
+                    pattern = 0;
+                }
+                else if (kind == 1)
+                {
+                    pattern = ref_nth_pattern(pattern >> 1) ^
+                              (pattern & 1 ? 0xffffffff : 0);
+                }
+                for (int y = ty; y < ty + 8 && y < h; y++)
+                {
+                    for (int x = tx; x < tx + 4 && x < w; x++)
+                    {
+                        int            bit = 31 - (y - ty) * 4 - (x - tx);
+                        uint32_t       c   = colors[(pattern >> bit) & 1];
+                        unsigned char *p   = px + ((size_t)w * y + x) * 3;
+                        p[0]               = (unsigned char)(c >> 16);
+                        p[1]               = (unsigned char)(c >> 8);
+                        p[2]               = (unsigned char)c;
+                    }
+                }
+            }
+        }
+
+        px = new_pixels(&corpus[count++], w, h, "gradient");
+        for (int y = 0; y < h; y++)
+        {
+            for (int x = 0; x < w; x++, px += 3)
+            {
+                px[0] = (unsigned char)(x * 255 / w);
+                px[1] = (unsigned char)(y * 255 / h);
+                px[2] = (unsigned char)((x + y) * 255 / (w + h));
+            }
+        }
+    }
+    return count;
+}
+
+// Encoded files per entry of CHECK_FILE_SIZES: six JPEGs, eight PNGs and
+// two PNMs.
+#define CHECK_FILES_PER_SIZE 16
+
+static void add_file(struct check_file *file, outbuf_t *out, const char *fmt,
+                     ...) __attribute__((format(printf, 3, 4)));
+
+static void add_file(struct check_file *file, outbuf_t *out, const char *fmt,
+                     ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(file->name, sizeof(file->name), fmt, ap);
+    va_end(ap);
+    file->data = (unsigned char *)out->data;
+    file->len  = (int)out->len;
+    outbuf_init(out);
+}
+
+// A synthetic photo (gradients, hard edges, noise, and alpha from fully
+// transparent to opaque) in every format the decoder has a path for.
+static int make_files(struct check_state *st, struct check_file *files)
+{
+    int count = 0;
+    for (size_t s = 0;
+         s < sizeof(CHECK_FILE_SIZES) / sizeof(CHECK_FILE_SIZES[0]); s++)
+    {
+        int    w      = CHECK_FILE_SIZES[s][0];
+        int    h      = CHECK_FILE_SIZES[s][1];
+        size_t pixels = (size_t)w * h;
+
+        unsigned char *rgba = (unsigned char *)malloc(pixels * 4);
+        uint16_t      *wide = (uint16_t *)malloc(pixels * 4 * sizeof(uint16_t));
+        for (int y = 0; y < h; y++)
+        {
+            for (int x = 0; x < w; x++)
+            {
+                unsigned char *p = rgba + ((size_t)y * w + x) * 4;
+                int            n = check_rand(st) & 15;
+                p[0] = (unsigned char)(x * 240 / w + n);
+                p[1] = (unsigned char)(y * 240 / h + n);
+                p[2] = (unsigned char)(120 + 100 * sin(x / 5.0) * cos(y / 7.0) +
+                                       n);
+                p[3] = (unsigned char)(x < w / 4 ? 0 : x < w / 2 ? x * y : 255);
+                for (int c = 0; c < 4; c++)
+                {
+                    uint16_t noise = c == 3 && p[3] == 0
+                                         ? 0
+                                         : (uint16_t)(check_rand(st) & 0xff);
+                    wide[((size_t)y * w + x) * 4 + c] =
+                        (uint16_t)(p[c] * 257 ^ noise);
+                }
+            }
+        }
+
+        // The same pixels as luma, luma + alpha, RGB and RGBA.
+        unsigned char *px[5];
+        uint16_t      *wpx[5];
+        for (int ch = 1; ch <= 4; ch++)
+        {
+            px[ch]  = (unsigned char *)malloc(pixels * ch);
+            wpx[ch] = (uint16_t *)malloc(pixels * ch * sizeof(uint16_t));
+            for (size_t i = 0; i < pixels; i++)
+            {
+                const unsigned char *p = rgba + i * 4;
+                const uint16_t      *q = wide + i * 4;
+                for (int c = 0; c < ch; c++)
+                {
+                    bool a  = ch % 2 == 0 && c == ch - 1;
+                    int  sc = a ? 3 : c;
+                    px[ch][i * ch + c] = ch < 3 && !a ? luma(p) : p[sc];
+                    wpx[ch][i * ch + c] =
+                        ch < 3 && !a ? (uint16_t)(luma(p) * 257) : q[sc];
+                }
+            }
+        }
+
+        outbuf_t out;
+        outbuf_init(&out);
+        for (int restart = 0; restart <= 2; restart += 2)
+        {
+            jpeg_encode(&out, px[1], w, h, 1, 1, restart);
+            add_file(&files[count++], &out, "gray JPEG %dx%d, restart %d", w,
+                     h, restart);
+            jpeg_encode(&out, px[3], w, h, 3, 1, restart);
+            add_file(&files[count++], &out, "4:4:4 JPEG %dx%d, restart %d", w,
+                     h, restart);
+            jpeg_encode(&out, px[3], w, h, 3, 2, restart);
+            add_file(&files[count++], &out, "4:2:0 JPEG %dx%d, restart %d", w,
+                     h, restart);
+        }
+        for (int ch = 1; ch <= 4; ch++)
+        {
+            uint16_t *samples = (uint16_t *)malloc(pixels * ch *
+                                                   sizeof(uint16_t));
+            for (size_t i = 0; i < pixels * ch; i++)
+            {
+                samples[i] = px[ch][i];
+            }
+            png_encode(&out, samples, w, h, ch, 8);
+            add_file(&files[count++], &out, "%d channel PNG %dx%d", ch, w, h);
+            png_encode(&out, wpx[ch], w, h, ch, 16);
+            add_file(&files[count++], &out, "%d channel 16-bit PNG %dx%d", ch,
+                     w, h);
+            free(samples);
+        }
+        pnm_encode(&out, px[1], w, h, 1);
+        add_file(&files[count++], &out, "PGM %dx%d", w, h);
+        pnm_encode(&out, px[3], w, h, 3);
+        add_file(&files[count++], &out, "PPM %dx%d", w, h);
+        outbuf_free(&out);
+
+        for (int ch = 1; ch <= 4; ch++)
+        {
+            free(px[ch]);
+            free(wpx[ch]);
+        }
+        free(rgba);
+        free(wide);
+    }
+    return count;
+}
+
+static int load_file(const char         *path,
+                     struct check_file  *file,
+                     struct check_image *ci)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    fseek(fp, 0L, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0L, SEEK_SET);
+
+    unsigned char *data = (unsigned char *)malloc(size > 0 ? size : 1);
+    bool ok = size > 0 && fread(data, size, 1, fp) == 1;
+    fclose(fp);
+
+    // Decoded only as large as the largest terminal checked needs: every
+    // render starts from these pixels.
+    print_img_opts_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.width  = CHECK_TERMS[2][0] * 4;
+    opts.height = CHECK_TERMS[2][1] * 8;
+    if (!ok || print_img_decode(data, (int)size, &opts, &ci->image) != 0)
+    {
+        fprintf(stderr, "check: cannot decode %s\n", path);
+        free(data);
+        return -1;
+    }
+    snprintf(ci->name, sizeof(ci->name), "%s", path);
+    snprintf(file->name, sizeof(file->name), "%s", path);
+    file->data = data;
+    file->len  = (int)size;
+    return 0;
+}
+
+// Thread counts to check: one, even and odd splits, and the whole pool.
+static int next_thread_count(int threads, int max_threads)
+{
+    return threads < 3 || threads >= max_threads ? threads + 1 : max_threads;
+}
+
+static void compare_bytes(struct check_state *st,
+                          const outbuf_t     *out,
+                          const char         *what)
+{
+    st->checks++;
+    size_t len = out->len < st->ref.len ? out->len : st->ref.len;
+    size_t i   = 0;
+    while (i < len && out->data[i] == st->ref.data[i])
+    {
+        i++;
+    }
+    if (i < len || out->len != st->ref.len)
+    {
+        check_report(st, "%s: output differs at byte %zu (%zu vs %zu bytes)",
+                     what, i, out->len, st->ref.len);
+    }
+}
+
+// Pixels against a reference, allowing for max_diff per sample and
+// mean_diff on average.
+static void compare_pixels(struct check_state  *st,
+                           const char          *what,
+                           const unsigned char *out,
+                           int                  width,
+                           int                  height,
+                           const unsigned char *ref,
+                           int                  ref_width,
+                           int                  ref_height,
+                           int                  channels,
+                           int                  max_diff,
+                           double               mean_diff)
+{
+    st->checks++;
+    if (width != ref_width || height != ref_height)
+    {
+        check_report(st, "%s: %dx%d, reference %dx%d", what, width, height,
+                     ref_width, ref_height);
+        return;
+    }
+
+    size_t samples = (size_t)width * height * channels;
+    size_t worst   = 0;
+    int    max     = 0;
+    double sum     = 0;
+    for (size_t i = 0; i < samples; i++)
+    {
+        int d = abs(out[i] - ref[i]);
+        sum += d;
+        if (d > max)
+        {
+            max   = d;
+            worst = i;
+        }
+    }
+    if (max > max_diff || (samples > 0 && sum / samples > mean_diff))
+    {
+        check_report(st,
+                     "%s: sample %zu of %zu is %d, reference %d (mean "
+                     "difference %.3f)",
+                     what, worst, samples, out[worst], ref[worst],
+                     sum / samples);
+    }
+}
+
+static void compare_cells(struct check_state      *st,
+                          const print_img_frame_t *frame,
+                          const print_img_frame_t *ref,
+                          const char              *what)
+{
+    st->checks++;
+    int cols, rows, ref_cols, ref_rows;
+    print_img_frame_grid(frame, &cols, &rows);
+    print_img_frame_grid(ref, &ref_cols, &ref_rows);
+    if (cols != ref_cols || rows != ref_rows)
+    {
+        check_report(st, "%s: %dx%d cells, reference %dx%d", what, cols, rows,
+                     ref_cols, ref_rows);
+        return;
+    }
+
+    for (int row = 0; row < rows; row++)
+    {
+        for (int col = 0; col < cols; col++)
+        {
+            unsigned int cp, ref_cp;
+            int          fg, bg, ref_fg, ref_bg;
+            print_img_frame_cell(frame, col, row, &cp, &fg, &bg);
+            print_img_frame_cell(ref, col, row, &ref_cp, &ref_fg, &ref_bg);
+            if (cp != ref_cp || fg != ref_fg || bg != ref_bg)
+            {
+                check_report(st,
+                             "%s: cell %d,%d U+%04X #%06x/#%06x, reference "
+                             "U+%04X #%06x/#%06x",
+                             what, col, row, cp, fg, bg, ref_cp, ref_fg,
+                             ref_bg);
+                return;
+            }
+        }
+    }
+}
+
+static void render(const print_img_image_t *image,
+                   const print_img_opts_t  *opts,
+                   outbuf_t                *out)
+{
+    out->len = 0;
+    print_img_render_buf(image, opts, out);
+}
+
+// One image in one configuration: the single-threaded render without a frame
+// is the reference for the other thread counts, with and without a frame,
+// and for a second frame served from the block cache.
+static void check_render(struct check_state        *st,
+                         const struct check_image  *ci,
+                         const struct check_config *cfg,
+                         int                        term,
+                         int                        max_threads)
+{
+    print_img_opts_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.mode         = cfg->mode;
+    opts.glyphs       = cfg->glyphs;
+    opts.colors       = cfg->colors;
+    opts.resample     = cfg->resample;
+    opts.term_caps    = cfg->term_caps;
+    opts.term_cols    = CHECK_TERMS[term][0];
+    opts.term_rows    = CHECK_TERMS[term][1];
+    opts.always_clear = 1;  // no dependence on the previous render's size
+
+    bool cells = cfg->mode == PRINT_MODE_BLOCK;
+
+    pool_limit(1);
+    render(&ci->image, &opts, &st->ref);
+    print_img_frame_t *ref_frame = print_img_frame_create();
+    if (cells)
+    {
+        opts.frame = ref_frame;
+        render(&ci->image, &opts, &st->out);
+        opts.frame = NULL;
+    }
+
+    for (int threads = 1; threads <= max_threads;
+         threads = next_thread_count(threads, max_threads))
+    {
+        char what[160];
+        snprintf(what, sizeof(what), "%s, %s, %dx%d terminal, %d thread%s",
+                 ci->name, cfg->name, opts.term_cols, opts.term_rows, threads,
+                 threads > 1 ? "s" : "");
+        pool_limit(threads);
+
+        if (threads > 1)
+        {
+            render(&ci->image, &opts, &st->out);
+            compare_bytes(st, &st->out, what);
+        }
+        if (!cells)
+        {
+            continue;
+        }
+
+        print_img_frame_t *frame = print_img_frame_create();
+        opts.frame               = frame;
+        render(&ci->image, &opts, &st->out);
+        compare_bytes(st, &st->out, what);
+        compare_cells(st, frame, ref_frame, what);
+
+        // Same pixels again: every block comes from the cache.
+        char cached[176];
+        snprintf(cached, sizeof(cached), "%s, cached", what);
+        render(&ci->image, &opts, &st->out);
+        compare_cells(st, frame, ref_frame, cached);
+
+        opts.frame = NULL;
+        print_img_frame_free(frame);
+    }
+
+    print_img_frame_free(ref_frame);
+}
+
+// Distinct colors of a 4x8 block, counted up to 3; the first two in colors.
+static int block_colors(const unsigned char *px,
+                        int                  x0,
+                        int                  y0,
+                        int                  width,
+                        int                  colors[2])
+{
+    int count = 0;
+    for (int y = y0; y < y0 + 8; y++)
+    {
+        for (int x = x0; x < x0 + 4; x++)
+        {
+            const unsigned char *p = px + ((size_t)width * y + x) * 3;
+            int color = (p[0] << 16) | (p[1] << 8) | p[2];
+            int i     = 0;
+            while (i < count && colors[i] != color)
+            {
+                i++;
+            }
+            if (i == count)
+            {
+                if (count == 2)
+                {
+                    return 3;
+                }
+                colors[count++] = color;
+            }
+        }
+    }
+    return count;
+}
+
+static int pack_color(const int *rgb)
+{
+    return (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+}
+
+// Pixels of a 4x8 block the cell draws in a color other than their own.
+static int cell_misses(const unsigned char *px,
+                       int                  x0,
+                       int                  y0,
+                       int                  width,
+                       unsigned int         pattern,
+                       int                  fg,
+                       int                  bg)
+{
+    int          misses = 0;
+    unsigned int mask   = 0x80000000;
+    for (int y = y0; y < y0 + 8; y++)
+    {
+        for (int x = x0; x < x0 + 4; x++, mask >>= 1)
+        {
+            const unsigned char *p = px + ((size_t)width * y + x) * 3;
+            int color = (p[0] << 16) | (p[1] << 8) | p[2];
+            misses += color != (pattern & mask ? fg : bg);
+        }
+    }
+    return misses;
+}
+
+// Fewest pixels a cell drawn as codepoint misses, over the table entries
+// for it; some glyphs have several.
+static int glyph_misses(const unsigned char *px,
+                        int                  x0,
+                        int                  y0,
+                        int                  width,
+                        unsigned int         codepoint,
+                        int                  fg,
+                        int                  bg)
+{
+    int best = 33;
+    for (int i = 0; REF_BITMAPS[i + 1] != 0; i += 2)
+    {
+        if (REF_BITMAPS[i + 1] == codepoint)
+        {
+            int misses =
+                cell_misses(px, x0, y0, width, REF_BITMAPS[i], fg, bg);
+            best = misses < best ? misses : best;
+        }
+    }
+    return best;
+}
+
+// Block mode cells against the reference matcher, with one 4x8 block of
+// pixels per cell so that nothing is resized. A flat block must come out
+// as the reference's blank; the foreground of a blank is never drawn. A
+// two-tone block gets the reference's glyph in exactly its two colors,
+// missing no more pixels than the reference's glyph does; the colors
+// differ from the reference's averages only when that glyph misses some,
+// and those cells are counted.
+static void check_cells(struct check_state *st, const struct check_image *ci)
+{
+    int cols = ci->image.width / 4;
+    int rows = ci->image.height / 8;
+    if (ci->image.channels != 3 || cols == 0 || rows == 0)
+    {
+        return;
+    }
+
+    int            w  = cols * 4;
+    int            h  = rows * 8;
+    unsigned char *px = (unsigned char *)malloc((size_t)w * h * 3);
+    for (int y = 0; y < h; y++)
+    {
+        memcpy(px + (size_t)y * w * 3,
+               ci->image.pixels + (size_t)y * ci->image.width * 3,
+               (size_t)w * 3);
+    }
+    print_img_image_t image = ci->image;
+    image.pixels            = px;
+    image.width             = w;
+    image.height            = h;
+
+    print_img_frame_t *frame = print_img_frame_create();
+    print_img_opts_t   opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.mode         = PRINT_MODE_BLOCK;
+    opts.width        = w;
+    opts.height       = h;
+    opts.always_clear = 1;
+    opts.frame        = frame;
+    pool_limit(0);
+    render(&image, &opts, &st->out);
+
+    char what[96];
+    snprintf(what, sizeof(what), "%s, block cells", ci->name);
+    st->checks++;
+    int grid_cols, grid_rows;
+    print_img_frame_grid(frame, &grid_cols, &grid_rows);
+    if (grid_cols != cols || grid_rows != rows)
+    {
+        check_report(st, "%s: %dx%d cells, expected %dx%d", what, grid_cols,
+                     grid_rows, cols, rows);
+        rows = 0;
+    }
+
+    for (int row = 0; row < rows; row++)
+    {
+        for (int col = 0; col < cols; col++)
+        {
+            int            colors[2];
+            int            count = block_colors(px, col * 4, row * 8, w, colors);
+            ref_chardata_t ref   = ref_find_chardata(px, col * 4, row * 8, w);
+            unsigned int   cp;
+            int            fg, bg;
+            print_img_frame_cell(frame, col, row, &cp, &fg, &bg);
+            bool same = cp == (unsigned int)ref.codepoint &&
+                        fg == pack_color(ref.fg_color) &&
+                        bg == pack_color(ref.bg_color);
+            if (count == 1)
+            {
+                same = cp == (unsigned int)ref.codepoint &&
+                       bg == pack_color(ref.bg_color);
+            }
+            else if (count == 2 && !same && ref.diff > 0 &&
+                     cp == (unsigned int)ref.codepoint &&
+                     ((fg == colors[0] && bg == colors[1]) ||
+                      (fg == colors[1] && bg == colors[0])))
+            {
+                // With no glyph within 8 pixels the U+2584 fallback has
+                // the rarer color in front: at least half the pixels are
+                // not in it.
+                if (ref.diff < 8)
+                {
+                    same = glyph_misses(px, col * 4, row * 8, w, cp, fg,
+                                        bg) == ref.diff;
+                }
+                else
+                {
+                    same = cell_misses(px, col * 4, row * 8, w, 0xffffffff,
+                                       fg, bg) >= 16;
+                }
+                st->two_tone_cells += same;
+            }
+            if (!same)
+            {
+                check_report(st,
+                             "%s: cell %d,%d U+%04X #%06x/#%06x, reference "
+                             "U+%04X #%06x/#%06x",
+                             what, col, row, cp, fg, bg, ref.codepoint,
+                             pack_color(ref.fg_color),
+                             pack_color(ref.bg_color));
+                row = rows;
+                break;
+            }
+        }
+    }
+
+    print_img_frame_free(frame);
+    free(px);
+}
+
+
+static const char *resample_name(int resample)
+{
+    return resample == PRINT_RESAMPLE_AREA    ? "area"
+           : resample == PRINT_RESAMPLE_STBIR ? "stbir"
+                                              : "auto";
+}
+
+// Every resampler on luma, luma + alpha, RGB and RGBA against the
+// reference resizers, at several thread counts; the fused YUV conversion
+// against its own single-threaded run.
+static void check_resize(struct check_state       *st,
+                         const struct check_image *ci,
+                         int                       max_threads)
+{
+    const print_img_image_t *img = &ci->image;
+    if (img->channels != 3)
+    {
+        return;
+    }
+
+    // Large images are cropped to keep the run short.
+    int w = img->width < CHECK_RESIZE_MAX ? img->width : CHECK_RESIZE_MAX;
+    int h = img->height < CHECK_RESIZE_MAX ? img->height : CHECK_RESIZE_MAX;
+
+    // The same pixels as luma and with a made-up alpha channel.
+    size_t         pixels = (size_t)w * h;
+    unsigned char *src[5];
+    for (int ch = 1; ch <= 4; ch++)
+    {
+        src[ch] = (unsigned char *)malloc(pixels * ch);
+        for (size_t i = 0; i < pixels; i++)
+        {
+            const unsigned char *p =
+                img->pixels + ((i / w) * img->width + i % w) * 3;
+            unsigned char *d = src[ch] + i * ch;
+            if (ch < 3)
+            {
+                d[0] = (unsigned char)luma(p);
+            }
+            else
+            {
+                memcpy(d, p, 3);
+            }
+            if (ch % 2 == 0)
+            {
+                d[ch - 1] = (unsigned char)(i * 37);
+            }
+        }
+    }
+
+    // Large and small reductions, the same size and an enlargement.
+    int sizes[][2] = {{w / 5 + 1, h / 7 + 1},
+                      {w / 2 + 1, h},
+                      {w, h},
+                      {w * 2 + 1, h + 3}};
+    for (int s = 0; s < 4; s++)
+    {
+        int            dw   = sizes[s][0];
+        int            dh   = sizes[s][1];
+        size_t         size = (size_t)dw * dh * 3;
+        unsigned char *ref  = (unsigned char *)malloc(size);
+        unsigned char *out  = (unsigned char *)malloc(size);
+
+        for (int resample = PRINT_RESAMPLE_AUTO;
+             resample <= PRINT_RESAMPLE_AREA; resample++)
+        {
+            for (int ch = 1; ch <= 4; ch++)
+            {
+                int color = ch % 2 == 0 ? ch - 1 : ch;
+                if (ch % 2 != 0 && dw == w && dh == h)
+                {
+                    continue;
+                }
+                ref_resize(src[ch], w, h, ref, dw, dh, ch, resample,
+                           0x336699);
+                for (int threads = 1; threads <= max_threads;
+                     threads = next_thread_count(threads, max_threads))
+                {
+                    char what[160];
+                    snprintf(what, sizeof(what),
+                             "%s, %s resize to %dx%d, %d channels, %d "
+                             "threads",
+                             ci->name, resample_name(resample), dw, dh, ch,
+                             threads);
+                    pool_limit(threads);
+                    resize_image(src[ch], w, h, out, dw, dh, ch, resample,
+                                 0x336699);
+                    compare_pixels(st, what, out, dw, dh, ref, dw, dh, color,
+                                   0, 0);
+                }
+            }
+        }
+
+        // The RGB bytes double as Y, U and V planes.
+        if (dw <= w && dh <= h)
+        {
+            size_t               chroma = (size_t)((w + 1) / 2) * ((h + 1) / 2);
+            const unsigned char *y      = src[3];
+            pool_limit(1);
+            resize_yuv420(y, y + pixels, y + pixels + chroma, w, h, ref, dw,
+                          dh, 3, false);
+            for (int threads = 2; threads <= max_threads;
+                 threads = next_thread_count(threads, max_threads))
+            {
+                char what[160];
+                snprintf(what, sizeof(what),
+                         "%s, YUV 4:2:0 to %dx%d, %d threads", ci->name, dw,
+                         dh, threads);
+                pool_limit(threads);
+                resize_yuv420(y, y + pixels, y + pixels + chroma, w, h, out,
+                              dw, dh, 3, false);
+                compare_pixels(st, what, out, dw, dh, ref, dw, dh, 3, 0, 0);
+            }
+        }
+
+        free(ref);
+        free(out);
+    }
+    for (int ch = 1; ch <= 4; ch++)
+    {
+        free(src[ch]);
+    }
+}
+
+// Luma of each pixel, the first channel when there is no color.
+static unsigned char *luma_plane(const unsigned char *px,
+                                 int                  width,
+                                 int                  height,
+                                 int                  channels)
+{
+    size_t         pixels = (size_t)width * height;
+    unsigned char *out    = (unsigned char *)malloc(pixels ? pixels : 1);
+    for (size_t i = 0; i < pixels; i++)
+    {
+        const unsigned char *p = px + i * channels;
+        out[i] = (unsigned char)(channels < 3 ? p[0] : luma(p));
+    }
+    return out;
+}
+
+// decode_image() against the reference decode, as luma and RGB (plus
+// alpha when the file has it), at full size and at every reduction it
+// supports, at several thread counts. Reduced JPEGs come from a scaled IDCT
+// and reduced chroma, which only approximate a box average, most of all in
+// the chroma: they are compared as luma, with a tolerance. Corrupt input
+// only has to agree at full size, where both decoders accept it.
+static void check_decode(struct check_state      *st,
+                         const struct check_file *file,
+                         int                      max_threads,
+                         bool                     corrupt)
+{
+    const unsigned char *buf = file->data;
+    int                  len = file->len;
+    int                  fw, fh, fn;
+    if (!stbi_info_from_memory(buf, len, &fw, &fh, &fn))
+    {
+        if (!corrupt)
+        {
+            check_report(st, "%s: stb_image cannot read it", file->name);
+        }
+        fw = fh = 0;
+        fn = 3;
+    }
+
+    // HDR tone mapping has no independent reference: it is only checked
+    // against its own single-threaded run.
+    bool hdr       = stbi_is_hdr_from_memory(buf, len);
+    bool wide      = stbi_is_16_bit_from_memory(buf, len);
+    bool jpeg      = len >= 2 && buf[0] == 0xff && buf[1] == 0xd8;
+    int  max_shift = jpeg ? 3 : (hdr || wide ? 4 : 0);
+
+    for (int base = 1; base <= 3; base += 2)
+    {
+        int channels = base + (fn % 2 == 0);
+        for (int shift = 0; shift <= max_shift; shift++)
+        {
+            if (shift > 0 && ((fw >> shift) < 1 || (fh >> shift) < 1))
+            {
+                break;
+            }
+            int min_w = shift > 0 ? fw >> shift : 0;
+            int min_h = shift > 0 ? fh >> shift : 0;
+
+            int            rw = 0, rh = 0;
+            unsigned char *ref = NULL;
+            if (corrupt && shift > 0)
+            {
+                // No reference: only run the decoder.
+            }
+            else if (hdr)
+            {
+                pool_limit(1);
+                ref = decode_image(buf, len, &rw, &rh, channels, min_w, min_h,
+                                   0);
+            }
+            else
+            {
+                ref = ref_decode(buf, len, &rw, &rh, channels, shift);
+            }
+
+            bool   approx    = jpeg && shift > 0;
+            int    max_diff  = approx ? CHECK_REDUCED_MAX : (wide ? 1 : 0);
+            double mean_diff = approx ? CHECK_REDUCED_MEAN : (wide ? 1 : 0);
+            if (approx && ref != NULL)
+            {
+                unsigned char *plane = luma_plane(ref, rw, rh, channels);
+                free(ref);
+                ref = plane;
+            }
+
+            for (int threads = 1; threads <= max_threads;
+                 threads = next_thread_count(threads, max_threads))
+            {
+                char what[160];
+                snprintf(what, sizeof(what),
+                         "%s, %d channels, 1/%d scale, %d threads", file->name,
+                         channels, 1 << shift, threads);
+                pool_limit(threads);
+                int            w = 0, h = 0;
+                unsigned char *out = decode_image(buf, len, &w, &h, channels,
+                                                  min_w, min_h, 0);
+                if (out == NULL && ref != NULL)
+                {
+                    st->checks++;
+                    check_report(st, "%s: failed, the reference decoded it",
+                                 what);
+                }
+                else if (out != NULL && ref != NULL && approx)
+                {
+                    unsigned char *plane = luma_plane(out, w, h, channels);
+                    compare_pixels(st, what, plane, w, h, ref, rw, rh, 1,
+                                   max_diff, mean_diff);
+                    free(plane);
+                }
+                else if (out != NULL && ref != NULL)
+                {
+                    compare_pixels(st, what, out, w, h, ref, rw, rh,
+                                   channels, max_diff, mean_diff);
+                }
+                stbi_image_free(out);
+            }
+            free(ref);
+        }
+    }
+}
+
+// Truncated and corrupted copies of a file through every decoder entry
+// point and, when it still decodes, a render. Besides the comparisons of
+// check_decode() this only asks for no crash (run under ASan to also catch
+// bad reads).
+static void check_fuzz(struct check_state      *st,
+                       const struct check_file *file,
+                       int                      max_threads)
+{
+    unsigned char *buf = (unsigned char *)malloc(file->len);
+    for (int i = 0; i < CHECK_FUZZ_CASES; i++)
+    {
+        struct check_file mutated;
+        memcpy(buf, file->data, file->len);
+        mutated.data = buf;
+        mutated.len  = file->len;
+        if (i % 2 == 0)
+        {
+            mutated.len = (int)(check_rand(st) % file->len);
+            snprintf(mutated.name, sizeof(mutated.name), "%s cut to %d",
+                     file->name, mutated.len);
+        }
+        else
+        {
+            int bytes = 1 + (int)(check_rand(st) % 8);
+            for (int b = 0; b < bytes; b++)
+            {
+                buf[check_rand(st) % file->len] = (unsigned char)check_rand(st);
+            }
+            snprintf(mutated.name, sizeof(mutated.name), "%s, %d bytes hit",
+                     file->name, bytes);
+        }
+        check_decode(st, &mutated, max_threads, true);
+
+        int            w, h;
+        unsigned char *out = decode_image_coarse(buf, mutated.len, &w, &h, 3,
+                                                 8, 8);
+        stbi_image_free(out);
+
+        out = decode_image(buf, mutated.len, &w, &h, 3, 0, 0, 0);
+        if (out != NULL)
+        {
+            stbi_image_free(out);
+            print_img_opts_t opts;
+            memset(&opts, 0, sizeof(opts));
+            opts.term_cols = CHECK_TERMS[0][0];
+            opts.term_rows = CHECK_TERMS[0][1];
+            print_img_image_t image;
+            if (print_img_decode(buf, mutated.len, &opts, &image) == 0)
+            {
+                render(&image, &opts, &st->out);
+                print_img_image_free(&image);
+            }
+        }
+    }
+    free(buf);
+}
+
+// Glyph sets from the fewest shapes to the most.
+static int glyph_rank(int glyphs)
+{
+    return glyphs == PRINT_GLYPHS_HALF      ? 0
+           : glyphs == PRINT_GLYPHS_BLOCKS  ? 1
+           : glyphs == PRINT_GLYPHS_SEXTANT ? 3
+                                            : 2;
+}
+
+static int scale_percent(int cell_scale)
+{
+    return cell_scale > 0 && cell_scale < 100 ? cell_scale : 100;
+}
+
+// The frame rate controller from every combination of user knobs: level 0
+// leaves them as they are, and no level on the way down draws better.
+static void check_rate_ctl(struct check_state *st)
+{
+    static const int colors[] = {PRINT_COLORS_TRUE, PRINT_COLORS_256};
+    static const int glyphs[] = {PRINT_GLYPHS_FULL, PRINT_GLYPHS_BLOCKS,
+                                 PRINT_GLYPHS_HALF, PRINT_GLYPHS_SEXTANT};
+    static const int scales[] = {0, 60};
+    static const int tolerances[] = {0, 20};
+
+    for (int c = 0; c < 2; c++)
+    {
+        for (int g = 0; g < 4; g++)
+        {
+            for (int s = 0; s < 2; s++)
+            {
+                for (int t = 0; t < 2; t++)
+                {
+                    print_img_opts_t user;
+                    memset(&user, 0, sizeof(user));
+                    user.colors          = colors[c];
+                    user.glyphs          = glyphs[g];
+                    user.cell_scale      = scales[s];
+                    user.delta_tolerance = tolerances[t];
+
+                    char what[96];
+                    snprintf(what, sizeof(what),
+                             "rate control from colors %d, glyphs %d, scale "
+                             "%d, tolerance %d",
+                             user.colors, user.glyphs, user.cell_scale,
+                             user.delta_tolerance);
+
+                    rate_ctl_t rc;
+                    rate_ctl_init(&rc, 1000, &user);
+                    print_img_opts_t opts = user;
+                    st->checks++;
+                    if (rate_ctl_apply(&rc, &opts) ||
+                        memcmp(&opts, &user, sizeof(opts)) != 0)
+                    {
+                        check_report(st, "%s: level 0 changed them", what);
+                        continue;
+                    }
+
+                    // Every frame far over budget walks down the ladder.
+                    for (int frame = 0; frame < 64; frame++)
+                    {
+                        rate_ctl_update(&rc, 1.0, 0);
+                        rate_ctl_apply(&rc, &opts);
+                        if (opts.colors < user.colors ||
+                            glyph_rank(opts.glyphs) > glyph_rank(user.glyphs) ||
+                            scale_percent(opts.cell_scale) >
+                                scale_percent(user.cell_scale) ||
+                            opts.delta_tolerance < user.delta_tolerance)
+                        {
+                            check_report(st,
+                                         "%s: level %d draws better (colors "
+                                         "%d, glyphs %d, scale %d, tolerance "
+                                         "%d)",
+                                         what, rc.level, opts.colors,
+                                         opts.glyphs, opts.cell_scale,
+                                         opts.delta_tolerance);
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // Exercise several threads even on a single CPU.
+    setenv("PIMG_THREADS", "8", 0);
+
+    struct check_state st;
+    memset(&st, 0, sizeof(st));
+    st.rng = CHECK_SEED;
+    outbuf_init(&st.ref);
+    outbuf_init(&st.out);
+
+    int    paths   = argc - 1;
+    size_t sizes   = sizeof(CHECK_SIZES) / sizeof(CHECK_SIZES[0]);
+    size_t fsizes  = sizeof(CHECK_FILE_SIZES) / sizeof(CHECK_FILE_SIZES[0]);
+    size_t configs = sizeof(CHECK_CONFIGS) / sizeof(CHECK_CONFIGS[0]);
+    size_t terms   = sizeof(CHECK_TERMS) / sizeof(CHECK_TERMS[0]);
+
+    struct check_image *corpus = (struct check_image *)calloc(
+        paths + 3 * sizes, sizeof(struct check_image));
+    struct check_file *files = (struct check_file *)calloc(
+        paths + CHECK_FILES_PER_SIZE * fsizes, sizeof(struct check_file));
+    int images    = make_corpus(&st, corpus);
+    int generated = make_files(&st, files);
+    int nfiles    = generated;
+    for (int i = 1; i < argc; i++)
+    {
+        if (load_file(argv[i], &files[nfiles], &corpus[images]) == 0)
+        {
+            images++;
+            nfiles++;
+        }
+        else
+        {
+            st.divergences++;
+        }
+    }
+
+    check_rate_ctl(&st);
+
+    pool_limit(0);
+    int max_threads = pool_threads();
+
+    for (int i = 0; i < nfiles; i++)
+    {
+        check_decode(&st, &files[i], max_threads, false);
+        if (i < generated)
+        {
+            check_fuzz(&st, &files[i], max_threads);
+        }
+        free(files[i].data);
+    }
+
+    for (int i = 0; i < images; i++)
+    {
+        check_resize(&st, &corpus[i], max_threads);
+        check_cells(&st, &corpus[i]);
+        for (size_t c = 0; c < configs; c++)
+        {
+            for (size_t t = 0; t < terms; t++)
+            {
+                check_render(&st, &corpus[i], &CHECK_CONFIGS[c], (int)t,
+                             max_threads);
+            }
+        }
+        print_img_image_free(&corpus[i].image);
+    }
+    pool_limit(0);
+
+    fprintf(stderr,
+            "check: %d images, %d files, 1 to %d threads, %d checks, %d %s "
+            "(%d two-tone cells in their own colors)\n",
+            images, nfiles, max_threads, st.checks, st.divergences,
+            st.divergences == 1 ? "divergence" : "divergences",
+            st.two_tone_cells);
+
+    free(corpus);
+    free(files);
+    outbuf_free(&st.ref);
+    outbuf_free(&st.out);
+    return st.divergences == 0 ? 0 : 1;
+}
@@ -0,0 +1,398 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frame_ring.h"
+#include "img_resize.h"
+#include "outbuf.h"
+#include "print_img.h"
+#include "rate_ctl.h"
+#include "video.h"
+#include "writer.h"
+
+#define Y4M_MAX_LINE 1024
+
+// The reader thread and the signal handlers wake the render loop through this
+// pipe: 0 for a new frame or the end of input, otherwise a signal number.
+static int video_wake[2] = {-1, -1};
+
+struct video_stream
+{
+    int            fd;
+    int            format;
+    int            width;
+    int            height;
+    bool           full_range;  // Y4M: 0-255 levels instead of 16-235
+    size_t         frame_size;
+    frame_ring_t  *ring;
+};
+
+static void on_signal(int sig)
+{
+    int           saved = errno;
+    unsigned char b     = (unsigned char)sig;
+    write(video_wake[1], &b, 1);
+    errno = saved;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = read(fd, (char *)buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+// Read one '\n' terminated line without reading past it, since frame data
+// follows. Returns its length without the newline, or -1.
+static int read_line(int fd, char *line, int size)
+{
+    int len = 0;
+    for (;;)
+    {
+        char c;
+        if (read_full(fd, &c, 1) != 0)
+        {
+            return -1;
+        }
+        if (c == '\n')
+        {
+            break;
+        }
+        if (len < size - 1)
+        {
+            line[len++] = c;
+        }
+    }
+    line[len] = '\0';
+    return len;
+}
+
+// YUV4MPEG2 W<width> H<height> [C<chroma>] [XCOLORRANGE=FULL] ...
+static int parse_y4m_header(struct video_stream *vs)
+{
+    char line[Y4M_MAX_LINE];
+    if (read_line(vs->fd, line, sizeof(line)) < 0 ||
+        strncmp(line, "YUV4MPEG2", 9) != 0)
+    {
+        fprintf(stderr, "Input is not a Y4M stream\n");
+        return -1;
+    }
+
+    vs->width      = 0;
+    vs->height     = 0;
+    vs->full_range = false;
+    char *save     = NULL;
+    for (char *tok = strtok_r(line + 9, " ", &save); tok != NULL;
+         tok       = strtok_r(NULL, " ", &save))
+    {
+        if (tok[0] == 'W')
+        {
+            vs->width = atoi(tok + 1);
+        }
+        else if (tok[0] == 'H')
+        {
+            vs->height = atoi(tok + 1);
+        }
+        else if (tok[0] == 'C' && strcmp(tok, "C420") != 0 &&
+                 strcmp(tok, "C420jpeg") != 0 &&
+                 strcmp(tok, "C420paldv") != 0 &&
+                 strcmp(tok, "C420mpeg2") != 0)
+        {
+            fprintf(stderr, "Unsupported Y4M chroma format %s\n", tok + 1);
+            return -1;
+        }
+        else if (strcmp(tok, "XCOLORRANGE=FULL") == 0)
+        {
+            vs->full_range = true;
+        }
+    }
+
+    if (vs->width <= 0 || vs->height <= 0)
+    {
+        fprintf(stderr, "Y4M stream without a frame size\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void *reader_main(void *arg)
+{
+    struct video_stream *vs = (struct video_stream *)arg;
+    char                 line[Y4M_MAX_LINE];
+    unsigned char        wake = 0;
+
+    for (;;)
+    {
+        if (vs->format == PRINT_VIDEO_Y4M &&
+            (read_line(vs->fd, line, sizeof(line)) < 0 ||
+             strncmp(line, "FRAME", 5) != 0))
+        {
+            break;
+        }
+
+        // Replaces the previous frame if the render loop has not taken it.
+        unsigned char *slot = frame_ring_acquire(vs->ring);
+        if (read_full(vs->fd, slot, vs->frame_size) != 0)
+        {
+            break;
+        }
+        frame_ring_publish(vs->ring);
+        write(video_wake[1], &wake, 1);
+    }
+
+    frame_ring_close(vs->ring);
+    write(video_wake[1], &wake, 1);
+    return NULL;
+}
+
+struct video_ctx
+{
+    const struct video_stream *vs;
+    unsigned char             *pixels;  // converted Y4M frame
+    size_t                     pixels_cap;
+    outbuf_t                   frame;
+    print_img_opts_t           opts;  // knobs adjusted by rate
+    rate_ctl_t                *rate;  // NULL without a target frame rate
+};
+
+static void video_draw(struct video_ctx    *ctx,
+                       const unsigned char *data,
+                       bool                 full)
+{
+    const struct video_stream *vs = ctx->vs;
+
+    if (ctx->rate != NULL && rate_ctl_apply(ctx->rate, &ctx->opts))
+    {
+        full = true;
+    }
+
+    // Only draw a delta when the previous frame is sure to be on screen.
+    if (full || writer_has_pending())
+    {
+        print_img_frame_reset(ctx->opts.frame);
+    }
+
+    double start = now_seconds();
+
+    print_img_image_t image;
+    image.src_width  = vs->width;
+    image.src_height = vs->height;
+    if (vs->format == PRINT_VIDEO_RGB24)
+    {
+        image.pixels   = (unsigned char *)data;
+        image.width    = vs->width;
+        image.height   = vs->height;
+        image.channels = 3;
+    }
+    else
+    {
+        // Convert straight to the output size when shrinking. Otherwise
+        // convert at the source size and let the renderer scale up.
+        unsigned int out_w, out_h;
+        print_img_output_size(vs->width, vs->height, &ctx->opts, &out_w,
+                              &out_h);
+        if ((int)out_w > vs->width || (int)out_h > vs->height)
+        {
+            out_w = vs->width;
+            out_h = vs->height;
+        }
+
+        image.width    = out_w;
+        image.height   = out_h;
+        image.channels = print_img_channels(&ctx->opts);
+
+        size_t need = (size_t)out_w * out_h * image.channels;
+        if (need > ctx->pixels_cap)
+        {
+            free(ctx->pixels);
+            ctx->pixels     = (unsigned char *)malloc(need);
+            ctx->pixels_cap = need;
+        }
+        image.pixels = ctx->pixels;
+
+        size_t luma   = (size_t)vs->width * vs->height;
+        size_t chroma = (size_t)((vs->width + 1) / 2) * ((vs->height + 1) / 2);
+        resize_yuv420(data, data + luma, data + luma + chroma, vs->width,
+                      vs->height, image.pixels, out_w, out_h, image.channels,
+                      vs->full_range);
+    }
+
+    outbuf_puts(&ctx->frame, "\033[H");
+    print_img_render_buf(&image, &ctx->opts, &ctx->frame);
+    double render_seconds = now_seconds() - start;
+    size_t bytes          = ctx->frame.len;
+
+    writer_submit(&ctx->frame, full);
+    if (ctx->rate != NULL)
+    {
+        rate_ctl_update(ctx->rate, render_seconds, bytes);
+    }
+}
+
+int print_img_video(int                     fd,
+                    int                     format,
+                    int                     width,
+                    int                     height,
+                    const print_img_opts_t *opts,
+                    double                  fps)
+{
+    struct video_stream vs;
+    memset(&vs, 0, sizeof(vs));
+    vs.fd     = fd;
+    vs.format = format;
+    vs.width  = width;
+    vs.height = height;
+    if (format == PRINT_VIDEO_Y4M)
+    {
+        if (parse_y4m_header(&vs) != 0)
+        {
+            return -1;
+        }
+        size_t chroma = (size_t)((vs.width + 1) / 2) * ((vs.height + 1) / 2);
+        vs.frame_size = (size_t)vs.width * vs.height + 2 * chroma;
+    }
+    else
+    {
+        if (width <= 0 || height <= 0)
+        {
+            fprintf(stderr, "Raw video needs a frame size\n");
+            return -1;
+        }
+        vs.frame_size = (size_t)width * height * 3;
+    }
+
+    vs.ring = frame_ring_create(vs.frame_size);
+    if (vs.ring == NULL || pipe(video_wake) != 0)
+    {
+        fprintf(stderr, "Cannot allocate video buffers\n");
+        frame_ring_destroy(vs.ring);
+        return -1;
+    }
+    fcntl(video_wake[0], F_SETFL, fcntl(video_wake[0], F_GETFL) | O_NONBLOCK);
+    fcntl(video_wake[1], F_SETFL, fcntl(video_wake[1], F_GETFL) | O_NONBLOCK);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sa.sa_flags   = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    struct video_ctx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.vs         = &vs;
+    ctx.opts       = *opts;
+    ctx.opts.frame = print_img_frame_create();
+    outbuf_init(&ctx.frame);
+
+    rate_ctl_t rate;
+    if (fps > 0)
+    {
+        rate_ctl_init(&rate, fps, &ctx.opts);
+        ctx.rate = &rate;
+    }
+
+    pthread_t reader;
+    pthread_create(&reader, NULL, reader_main, &vs);
+
+    printf("\033[?25l");  // hide cursor
+    fflush(stdout);
+    writer_start(STDOUT_FILENO);
+
+    bool full    = true;  // clear first, and after every resize
+    bool running = true;
+    bool ended   = false;
+    while (running)
+    {
+        struct pollfd pfd = {video_wake[0], POLLIN, 0};
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        {
+            break;
+        }
+
+        unsigned char buf[64];
+        ssize_t       n;
+        while ((n = read(video_wake[0], buf, sizeof(buf))) > 0)
+        {
+            for (ssize_t i = 0; i < n; i++)
+            {
+                if (buf[i] == SIGWINCH)
+                {
+                    full = true;
+                }
+                else if (buf[i] != 0)
+                {
+                    running = false;
+                }
+            }
+        }
+        if (!running)
+        {
+            break;
+        }
+
+        // The reader publishes its last frame before closing the ring, so
+        // look for a frame once more after seeing it closed.
+        ended = frame_ring_closed(vs.ring);
+
+        unsigned long        skipped;
+        const unsigned char *data = frame_ring_latest(vs.ring, &skipped);
+        if (data != NULL)
+        {
+            video_draw(&ctx, data, full);
+            full = false;
+        }
+        running = !ended;
+    }
+
+    writer_stop();
+    printf("\033[?25h");  // show cursor
+    fflush(stdout);
+
+    if (!ended)
+    {
+        pthread_cancel(reader);
+    }
+    pthread_join(reader, NULL);
+
+    signal(SIGWINCH, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    close(video_wake[0]);
+    close(video_wake[1]);
+    video_wake[0] = video_wake[1] = -1;
+
+    outbuf_free(&ctx.frame);
+    print_img_frame_free(ctx.opts.frame);
+    free(ctx.pixels);
+    frame_ring_destroy(vs.ring);
+    return 0;
+}
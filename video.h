@@ -0,0 +1,28 @@
+#ifndef _VIDEO_H
+#define _VIDEO_H
+
+#include "print_img.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PRINT_VIDEO_RGB24 0  // packed RGB frames of a size given by the caller
+#define PRINT_VIDEO_Y4M   1  // YUV4MPEG2 stream with 4:2:0 chroma
+
+// Play the frames read from fd until it ends or SIGINT/SIGTERM. A reader
+// thread keeps pulling frames while the newest one is rendered; frames that
+// arrive faster than the terminal can show them are dropped, never queued.
+// width and height are only used for PRINT_VIDEO_RGB24. With fps > 0 output
+// quality adapts to what the terminal link can carry at that rate.
+int print_img_video(int                     fd,
+                    int                     format,
+                    int                     width,
+                    int                     height,
+                    const print_img_opts_t *opts,
+                    double                  fps);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
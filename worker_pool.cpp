@@ -0,0 +1,137 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "worker_pool.h"
+
+#define POOL_MAX_THREADS 8
+
+// Workers are started on first use and stay around, so repeated renders do
+// not pay for thread creation.
+static pthread_once_t  pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t pool_run_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_lock     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  pool_wake     = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  pool_done     = PTHREAD_COND_INITIALIZER;
+static int             pool_size     = 1;
+static int             pool_cap      = 0;  // pool_limit(), 0 for none
+
+static __thread bool in_pool_task = false;
+
+static struct
+{
+    pool_task_fn fn;
+    void        *arg;
+    int          count;
+    int          next;
+    int          pending;
+} job;
+
+// Take the next task of the current job and run it. Called and returns with
+// pool_lock held.
+static void run_one_task(void)
+{
+    int          index = job.next++;
+    pool_task_fn fn    = job.fn;
+    void        *arg   = job.arg;
+
+    pthread_mutex_unlock(&pool_lock);
+    in_pool_task = true;
+    fn(arg, index);
+    in_pool_task = false;
+    pthread_mutex_lock(&pool_lock);
+
+    if (--job.pending == 0)
+    {
+        pthread_cond_signal(&pool_done);
+    }
+}
+
+static void *pool_worker(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&pool_lock);
+    for (;;)
+    {
+        while (job.next >= job.count)
+        {
+            pthread_cond_wait(&pool_wake, &pool_lock);
+        }
+        run_one_task();
+    }
+    return NULL;
+}
+
+static void pool_init(void)
+{
+    long        ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *env  = getenv("PIMG_THREADS");
+    if (env != NULL && atoi(env) > 0)
+    {
+        ncpu = atoi(env);
+    }
+    int  size = ncpu < 1 ? 1 : (ncpu > POOL_MAX_THREADS ? POOL_MAX_THREADS
+                                                         : (int)ncpu);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (int i = 1; i < size; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, pool_worker, NULL) != 0)
+        {
+            size = i;
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    pool_size = size;
+}
+
+int pool_threads(void)
+{
+    pthread_once(&pool_once, pool_init);
+    return pool_cap > 0 && pool_cap < pool_size ? pool_cap : pool_size;
+}
+
+void pool_limit(int threads)
+{
+    pool_cap = threads;
+}
+
+void pool_run(int count, pool_task_fn fn, void *arg)
+{
+    if (in_pool_task || pool_threads() == 1 || count == 1)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            fn(arg, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool_run_lock);
+    pthread_mutex_lock(&pool_lock);
+
+    job.fn      = fn;
+    job.arg     = arg;
+    job.count   = count;
+    job.next    = 0;
+    job.pending = count;
+    pthread_cond_broadcast(&pool_wake);
+
+    while (job.next < job.count)
+    {
+        run_one_task();
+    }
+    while (job.pending > 0)
+    {
+        pthread_cond_wait(&pool_done, &pool_lock);
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+    pthread_mutex_unlock(&pool_run_lock);
+}
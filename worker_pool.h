@@ -0,0 +1,18 @@
+#ifndef _WORKER_POOL_H
+#define _WORKER_POOL_H
+
+typedef void (*pool_task_fn)(void *arg, int index);
+
+// Number of threads (including the caller) that pool_run spreads work over:
+// the number of CPUs, or $PIMG_THREADS, capped at 8.
+int pool_threads(void);
+
+// Use at most threads of them from now on, 0 for all. Callers size their
+// work by pool_threads(), so this also changes how work is split up.
+void pool_limit(int threads);
+
+// Run fn(arg, index) for every index in [0, count) on the shared worker
+// threads plus the calling thread, and return once all of them are done.
+// Called from inside a task, the tasks simply run on the calling thread.
+void pool_run(int count, pool_task_fn fn, void *arg);
+#endif
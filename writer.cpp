@@ -0,0 +1,192 @@
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "outbuf.h"
+#include "record.h"
+#include "writer.h"
+
+#define WRITER_CLEAR "\033[H\033[J"
+
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  writer_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  writer_idle = PTHREAD_COND_INITIALIZER;
+
+static struct
+{
+    pthread_t      thread;
+    int            fd;
+    bool           running;
+    bool           stopping;
+    bool           busy;  // the thread is writing a frame
+    bool           has_pending;
+    bool           pending_clear;
+    outbuf_t       pending;
+    writer_stats_t stats;
+} writer;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *writer_main(void *arg)
+{
+    (void)arg;
+
+    outbuf_t current;
+    outbuf_init(&current);
+
+    pthread_mutex_lock(&writer_lock);
+    for (;;)
+    {
+        while (!writer.has_pending && !writer.stopping)
+        {
+            pthread_cond_wait(&writer_wake, &writer_lock);
+        }
+        if (!writer.has_pending)
+        {
+            break;
+        }
+
+        outbuf_t tmp       = current;
+        current            = writer.pending;
+        writer.pending     = tmp;
+        writer.pending.len = 0;
+        bool clear         = writer.pending_clear;
+
+        writer.has_pending   = false;
+        writer.pending_clear = false;
+        writer.busy          = true;
+        pthread_mutex_unlock(&writer_lock);
+
+        double start = now_seconds();
+        if (clear)
+        {
+            write(writer.fd, WRITER_CLEAR, sizeof(WRITER_CLEAR) - 1);
+        }
+        outbuf_flush_fd(&current, writer.fd);
+        double elapsed = now_seconds() - start;
+        print_img_record_frame(current.data, current.len, clear);
+
+        pthread_mutex_lock(&writer_lock);
+        writer.stats.frames++;
+        writer.stats.bytes += current.len;
+        writer.stats.seconds += elapsed;
+        writer.busy = false;
+        pthread_cond_broadcast(&writer_idle);
+    }
+    pthread_mutex_unlock(&writer_lock);
+
+    outbuf_free(&current);
+    return NULL;
+}
+
+void writer_start(int fd)
+{
+    if (writer.running)
+    {
+        return;
+    }
+
+    writer.fd            = fd;
+    writer.stopping      = false;
+    writer.busy          = false;
+    writer.has_pending   = false;
+    writer.pending_clear = false;
+    memset(&writer.stats, 0, sizeof(writer.stats));
+    outbuf_init(&writer.pending);
+
+    writer.running =
+        pthread_create(&writer.thread, NULL, writer_main, NULL) == 0;
+    if (!writer.running)
+    {
+        outbuf_free(&writer.pending);
+    }
+}
+
+void writer_stop(void)
+{
+    if (!writer.running)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&writer_lock);
+    writer.stopping = true;
+    pthread_cond_signal(&writer_wake);
+    pthread_mutex_unlock(&writer_lock);
+
+    pthread_join(writer.thread, NULL);
+    outbuf_free(&writer.pending);
+    writer.running = false;
+}
+
+bool writer_running(void)
+{
+    return writer.running;
+}
+
+void writer_submit(outbuf_t *frame, bool clear)
+{
+    if (!writer.running)
+    {
+        if (clear)
+        {
+            write(STDOUT_FILENO, WRITER_CLEAR, sizeof(WRITER_CLEAR) - 1);
+        }
+        outbuf_flush_fd(frame, STDOUT_FILENO);
+        print_img_record_frame(frame->data, frame->len, clear);
+        frame->len = 0;
+        return;
+    }
+
+    pthread_mutex_lock(&writer_lock);
+    if (writer.has_pending)
+    {
+        writer.stats.dropped++;
+    }
+
+    outbuf_t tmp   = writer.pending;
+    writer.pending = *frame;
+    *frame         = tmp;
+    frame->len     = 0;
+
+    writer.pending_clear = writer.pending_clear || clear;
+    writer.has_pending   = true;
+    pthread_cond_signal(&writer_wake);
+    pthread_mutex_unlock(&writer_lock);
+}
+
+void writer_drain(void)
+{
+    if (!writer.running)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&writer_lock);
+    while (writer.has_pending || writer.busy)
+    {
+        pthread_cond_wait(&writer_idle, &writer_lock);
+    }
+    pthread_mutex_unlock(&writer_lock);
+}
+
+bool writer_has_pending(void)
+{
+    pthread_mutex_lock(&writer_lock);
+    bool pending = writer.has_pending;
+    pthread_mutex_unlock(&writer_lock);
+    return pending;
+}
+
+void writer_get_stats(writer_stats_t *stats)
+{
+    pthread_mutex_lock(&writer_lock);
+    *stats = writer.stats;
+    pthread_mutex_unlock(&writer_lock);
+}
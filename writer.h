@@ -0,0 +1,41 @@
+#ifndef _WRITER_H
+#define _WRITER_H
+
+#include "outbuf.h"
+
+// Asynchronous frame output. A dedicated thread writes frames to fd while the
+// caller renders the next one. At most one frame waits behind the one being
+// written; a newer frame replaces it, so a slow terminal costs dropped frames
+// instead of stalls.
+void writer_start(int fd);
+
+// Stop after everything submitted has been written.
+void writer_stop(void);
+
+// Whether frames go through the writer thread, where one may be replaced
+// before it is written.
+bool writer_running(void);
+
+// Queue frame for output. Its buffer is swapped for an empty recycled one, so
+// the caller can encode the next frame into it right away. With clear set the
+// screen is cleared before the frame, even if a later frame replaces it.
+// Without a running writer the frame is written synchronously.
+void writer_submit(outbuf_t *frame, bool clear);
+
+// Wait until every submitted frame has been written.
+void writer_drain(void);
+
+// Whether a frame is waiting behind the one being written. Only a frame
+// submitted while nothing is pending is sure to reach the screen.
+bool writer_has_pending(void);
+
+typedef struct
+{
+    unsigned long frames;   // frames written
+    unsigned long dropped;  // frames replaced before they were written
+    size_t        bytes;    // bytes written
+    double        seconds;  // time spent in write()
+} writer_stats_t;
+
+void writer_get_stats(writer_stats_t *stats);
+#endif